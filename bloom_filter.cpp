@@ -0,0 +1,36 @@
+#include "bloom_filter.h"
+
+#include "key_set.h"
+
+BloomFilter::BloomFilter(u32 log2_bits) :
+    words((u64)1 << (log2_bits - 6), 0),
+    line_mask(words.size() / line_words - 1)
+{
+}
+
+// The line comes from the top bits of the hash, and each probe's bit within
+// it from 9 of the bits below them.
+u64 * BloomFilter::line(u64 hash) {
+  return &words[((hash >> 40) & line_mask) * line_words];
+}
+
+bool BloomFilter::may_contain(u128 key) {
+  u64 hash = KeySet::hash(key);
+  u64 * bits = line(hash);
+  for(u32 i=0; i<probes; i++) {
+    u32 bit = (hash >> (9*i)) & 511;
+    if(!(bits[bit >> 6] & ((u64)1 << (bit & 63)))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void BloomFilter::add(u128 key) {
+  u64 hash = KeySet::hash(key);
+  u64 * bits = line(hash);
+  for(u32 i=0; i<probes; i++) {
+    u32 bit = (hash >> (9*i)) & 511;
+    bits[bit >> 6] |= (u64)1 << (bit & 63);
+  }
+}
@@ -0,0 +1,29 @@
+#ifndef _BLOOM_FILTER_H
+#define _BLOOM_FILTER_H
+
+#include <vector>
+
+#include "util.h"
+
+// A Bloom filter of u128 keys. may_contain() is never wrong about a key that
+// was added, and only rarely says yes to one that wasn't. All the bits for a
+// key sit in one 64-byte line, so a check is a single cache miss at worst, and
+// the whole thing is meant to be small enough to stay in cache anyway.
+class BloomFilter {
+private:
+  static const u32 line_words = 8;
+  static const u32 probes = 4;
+
+  std::vector<u64> words;
+  u64 line_mask;
+
+  u64 * line(u64 hash);
+
+public:
+  BloomFilter(u32 log2_bits=23);
+
+  bool may_contain(u128 key);
+  void add(u128 key);
+};
+
+#endif // _BLOOM_FILTER_H
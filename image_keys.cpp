@@ -0,0 +1,120 @@
+#include "image_keys.h"
+
+#include <assert.h>
+#include <immintrin.h>
+
+static bool have_avx2 = __builtin_cpu_supports("avx2");
+static bool simd = have_avx2;
+
+bool simd_available() {
+  return have_avx2;
+}
+
+void use_simd(bool use) {
+  simd = use && have_avx2;
+}
+
+bool using_simd() {
+  return simd;
+}
+
+static u128 image_key_scalar(const u32 * stones, u32 count,
+                             u16 corner_x, u16 corner_y) {
+  u32 repr_list[max_key_stones];
+  for(u32 i=0; i<count; i++) {
+    u32 x = stones[i] & 0xffff;
+    u32 y = stones[i] >> 16;
+    repr_list[i] = ((y - corner_y) << 8) + (x - corner_x);
+  }
+  return repr_key(repr_list, count);
+}
+
+// One stone per lane. Subtracting the corner from (y << 16) + x all at once
+// can't borrow across the halves, since x is never below corner_x.
+__attribute__((target("avx2")))
+static u128 image_key_avx2(const u32 * stones, u32 count,
+                           u16 corner_x, u16 corner_y) {
+  __m256i v = _mm256_loadu_si256((const __m256i *)stones);
+  v = _mm256_sub_epi32(v, _mm256_set1_epi32(((u32)corner_y << 16) + corner_x));
+  __m256i packed = _mm256_add_epi32(
+      _mm256_slli_epi32(_mm256_srli_epi32(v, 16), 8),
+      _mm256_and_si256(v, _mm256_set1_epi32(0xffff)));
+  __m256i in_use = _mm256_cmpgt_epi32(
+      _mm256_set1_epi32(count), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+  packed = _mm256_blendv_epi8(_mm256_set1_epi32(0xffff), packed, in_use);
+
+  // Down to 16 bits a lane. packus works within each 128-bit half, so the
+  // halves then have to be brought together.
+  __m256i narrow = _mm256_packus_epi32(packed, _mm256_setzero_si256());
+  narrow = _mm256_permute4x64_epi64(narrow, 0x08);
+  __m128i lanes = _mm256_castsi256_si128(narrow);
+  // The first stone goes in the top bits, so the lanes go in backwards.
+  lanes = _mm_shuffle_epi8(lanes, _mm_setr_epi8(
+      14, 15, 12, 13, 10, 11, 8, 9, 6, 7, 4, 5, 2, 3, 0, 1));
+  u128 key;
+  _mm_storeu_si128((__m128i *)&key, lanes);
+  return key;
+}
+
+u128 image_key(const u32 * stones, u32 count, u16 corner_x, u16 corner_y) {
+  // Any more and they'd run past repr_list, or be cut off by the AVX2 load.
+  assert(count <= max_key_stones);
+  if(simd) {
+    return image_key_avx2(stones, count, corner_x, corner_y);
+  }
+  return image_key_scalar(stones, count, corner_x, corner_y);
+}
+
+// key_sort_network with a count only known at run time.
+static void sort_key_list_scalar(u32 * list, u32 count) {
+  u32 v[max_key_stones];
+  for(u32 i=0; i<max_key_stones; i++) {
+    v[i] = i < count ? list[i] : u32_max;
+  }
+  for(u32 i=0; i<key_sort_steps; i++) {
+    u32 a = v[key_sort_network[i][0]];
+    u32 b = v[key_sort_network[i][1]];
+    v[key_sort_network[i][0]] = a < b ? a : b;
+    v[key_sort_network[i][1]] = a < b ? b : a;
+  }
+  for(u32 i=0; i<count; i++) {
+    list[i] = v[i];
+  }
+}
+
+// A bitonic sort of the 8 lanes of one register: 6 rounds, each comparing
+// every lane with the one j away and keeping the min or the max.
+__attribute__((target("avx2")))
+static void sort_key_list_avx2(u32 * list, u32 count) {
+  static const s32 rounds[6][2] = {
+    {2, 1}, {4, 2}, {4, 1}, {8, 4}, {8, 2}, {8, 1}}; // Block size, distance.
+  __m256i index = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+  __m256i in_use = _mm256_cmpgt_epi32(_mm256_set1_epi32(count), index);
+  __m256i v = _mm256_maskload_epi32((const int *)list, in_use);
+  v = _mm256_blendv_epi8(_mm256_set1_epi32(-1), v, in_use);
+  for(u32 i=0; i<6; i++) {
+    __m256i block = _mm256_set1_epi32(rounds[i][0]);
+    __m256i distance = _mm256_set1_epi32(rounds[i][1]);
+    __m256i partner = _mm256_permutevar8x32_epi32(
+        v, _mm256_xor_si256(index, distance));
+    __m256i low = _mm256_min_epu32(v, partner);
+    __m256i high = _mm256_max_epu32(v, partner);
+    // A lane keeps the min if it's the first of its pair in an ascending
+    // block, or the second in a descending one.
+    __m256i is_second = _mm256_cmpeq_epi32(
+        _mm256_and_si256(index, distance), distance);
+    __m256i descending = _mm256_cmpeq_epi32(
+        _mm256_and_si256(index, block), block);
+    __m256i takes_high = _mm256_xor_si256(is_second, descending);
+    v = _mm256_blendv_epi8(low, high, takes_high);
+  }
+  _mm256_maskstore_epi32((int *)list, in_use, v);
+}
+
+void sort_key_list(u32 * list, u32 count) {
+  if(simd) {
+    sort_key_list_avx2(list, count);
+  } else {
+    sort_key_list_scalar(list, count);
+  }
+}
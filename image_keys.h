@@ -0,0 +1,70 @@
+#ifndef _IMAGE_KEYS_H
+#define _IMAGE_KEYS_H
+
+#include "util.h"
+
+const u16 max_key_stones = 8; // 16 bits per stone in a u128 key.
+
+// Packs a sorted repr_list (see Board::pack()) into one integer, 16 bits per
+// stone, with the first (smallest) entry in the top bits and unused entries
+// all ones. The span isn't needed: it's the largest x and y in the list, plus
+// one. Comparing two keys compares their lists lexicographically.
+inline u128 repr_key(const u32 repr_list[], u32 count) {
+  u128 key = 0;
+  for(u32 i=0; i<max_key_stones; i++) {
+    key = (key << 16) | (i < count ? repr_list[i] : 0xffff);
+  }
+  return key;
+}
+
+// The rest have an AVX2 version, used if the CPU has AVX2 (checked once, at
+// startup) and plain ones otherwise. A key has at most max_key_stones stones,
+// which is exactly one 256-bit register of u32s.
+
+// The key of one image of a board, given its stones as (y << 16) + x, sorted,
+// and its corner. The same as packing each stone against the corner and
+// calling repr_key(). stones must have room for max_key_stones entries, even
+// past count.
+u128 image_key(const u32 * stones, u32 count, u16 corner_x, u16 corner_y);
+
+// Sorts up to max_key_stones values, with a sorting network.
+void sort_key_list(u32 * list, u32 count);
+
+// Knuth's 19 comparator network for 8 inputs.
+const u32 key_sort_steps = 19;
+inline constexpr u8 key_sort_network[key_sort_steps][2] = {
+  {0, 2}, {1, 3}, {4, 6}, {5, 7},
+  {0, 4}, {1, 5}, {2, 6}, {3, 7},
+  {0, 1}, {2, 3}, {4, 5}, {6, 7},
+  {2, 4}, {3, 5},
+  {1, 4}, {3, 6},
+  {1, 2}, {3, 4}, {5, 6}};
+
+// The plain sort_key_list() for a count known at compile time. Missing inputs
+// are all ones, so they end up past the real ones; once the network is
+// unrolled, every comparison with one of them folds away, and a small count
+// is left with only a few.
+template <u32 count>
+inline void sort_key_list_fixed(u32 * list) {
+  u32 v[max_key_stones];
+  for(u32 i=0; i<max_key_stones; i++) {
+    v[i] = i < count ? list[i] : 0xffffffff;
+  }
+#pragma GCC unroll 19
+  for(u32 i=0; i<key_sort_steps; i++) {
+    u32 a = v[key_sort_network[i][0]];
+    u32 b = v[key_sort_network[i][1]];
+    v[key_sort_network[i][0]] = a < b ? a : b;
+    v[key_sort_network[i][1]] = a < b ? b : a;
+  }
+  for(u32 i=0; i<count; i++) {
+    list[i] = v[i];
+  }
+}
+
+bool simd_available();
+// For comparing the two; turning it on does nothing without AVX2.
+void use_simd(bool use);
+bool using_simd();
+
+#endif // _IMAGE_KEYS_H
@@ -1,25 +1,55 @@
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <immintrin.h>
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
 #include <list>
+#include <mutex>
+#include <set>
 #include <string>
 #include <thread>
-#include <set>
+#include <unordered_map>
+#include <vector>
 
+#include "bloom_filter.h"
+#include "image_keys.h"
+#include "key_set.h"
+#include "mapped_key_set.h"
+#include "net_comms.h"
 #include "util.h"
+#ifdef COUNT_MALLOCS
+#include "malloc_count.h"
+#endif
 
 #define MARK do{printf("%d\n", __LINE__); fflush(stdout);}while(0)
 
+// Multi-line output (board dumps, mostly) from separate threads turns to mush
+// unless it's serialized.
+std::mutex stdout_mutex;
+
 /*
 KNOWN:
 Stone Count | Best Score | Num Boards | Runtime
           2 |         16 | 5          |
           3 |         28 | 128        |
           4 |         38 | 7767       |     1m 02s
-          5 |         49 | 501823     | 5h 32m 48s
+          5 |         49 | 502068     | 5h 32m 48s
           6 |         60 |
+
+Depth 5 used to read 501823. pop() didn't put a stone's square back in its
+bucket, so every walk after the first on a Board could skip squares and miss
+some of the boards reachable from it. With that fixed (along with -j), both
+the walked set and -o count 502068 boards, 245 more.
 */
 
 /*
@@ -27,483 +57,2676 @@ TODO:
 * Skip report() when doing individual board.
 */
 
-#define DEFINE_INSERT(list_name) \
-  void list_name##_insert(Square * square) { \
-    if(square->list_name##_next != NULL) return; /*DON'T RE-INSERT!!!*/ \
-    square->list_name##_next = this->list_name##_next; \
-    square->list_name##_prev = this; \
-    square->list_name##_next->list_name##_prev = square; \
-    this->list_name##_next = square; \
-  }
-#define DEFINE_ERASE(list_name) \
-  void list_name##_erase() { \
-    if(this->list_name##_next == NULL) return; \
-    this->list_name##_prev->list_name##_next = this->list_name##_next; \
-    this->list_name##_next->list_name##_prev = this->list_name##_prev; \
-    this->list_name##_prev = this->list_name##_next = NULL; \
-  }
-class Square {
+// A square is an index into Board's per-square arrays (see Board::square_at()).
+// The lists link squares by index, and each list's guards get indices of their
+// own past the last square. A square that isn't in the list has no_link for
+// next and prev.
+const u32 no_link = 0xffffffff;
+#define DEFINE_LIST(list_name) \
+  std::vector<u32> list_name##_next; \
+  std::vector<u32> list_name##_prev; \
+  void list_name##_insert(u32 head, u32 square) { \
+    if(list_name##_next[square] != no_link) return; /*DON'T RE-INSERT!!!*/ \
+    list_name##_next[square] = list_name##_next[head]; \
+    list_name##_prev[square] = head; \
+    list_name##_prev[list_name##_next[head]] = square; \
+    list_name##_next[head] = square; \
+  } \
+  void list_name##_erase(u32 square) { \
+    if(list_name##_next[square] == no_link) return; \
+    list_name##_next[list_name##_prev[square]] = list_name##_next[square]; \
+    list_name##_prev[list_name##_next[square]] = list_name##_prev[square]; \
+    list_name##_prev[square] = list_name##_next[square] = no_link; \
+  } \
+  void list_name##_init(u32 head, u32 end) { \
+    list_name##_next[head] = end; \
+    list_name##_prev[end] = head; \
+  }
+
+const u16 max_depth_computable = 20; // Not enough time in the universe.
+
+// One subtree of Board::_all(): the stones of the board at its root. The stone
+// count is the depth at which _all() picks up.
+class WorkUnit {
 public:
-  u16 x;
-  u16 y;
-  u16 val;
-  u16 neighbor_sum;
-  u16 cached_neighbor_sum; //TODO
-
-  Square * neighbor_sums_next;
-  Square * neighbor_sums_prev;
-  Square * one_point_squares_next;
-  Square * one_point_squares_prev;
-  Square * visited_next;
-  Square * visited_prev;
-
-  DEFINE_INSERT(one_point_squares);
-  DEFINE_ERASE(one_point_squares);
-  DEFINE_INSERT(neighbor_sums);
-  DEFINE_ERASE(neighbor_sums);
-  DEFINE_INSERT(visited);
-  DEFINE_ERASE(visited);
-
-  Square() :
-      val(0),
-      neighbor_sum(0),
-      cached_neighbor_sum(0),
-      neighbor_sums_next(NULL),
-      neighbor_sums_prev(NULL),
-      one_point_squares_prev(NULL),
-      one_point_squares_next(NULL)
-  {
+  u16 stone_count;
+  u16 stones[max_depth_computable][2]; // x, y
+};
+
+// A deque of WorkUnits waiting to be run. The thread that owns it pushes and
+// pops at the back, so it runs depth first just like the single-threaded
+// search. Idle threads steal from the front, where the shallowest (and so
+// biggest) subtrees are.
+class WorkQueue {
+private:
+  std::deque<WorkUnit> units;
+  std::mutex mutex;
+
+public:
+  // Count of units pushed but not yet finished, shared by every queue in the
+  // pool. A unit's children are pushed before it is marked finished, so this
+  // only reaches zero once the whole search is done.
+  std::atomic<u64> * pending;
+
+  WorkQueue() : pending(NULL) {}
+
+  void push(const WorkUnit & unit) {
+    (*pending)++;
+    std::lock_guard<std::mutex> lock(mutex);
+    units.push_back(unit);
   }
 
-  void print() {
-    if(val == 0) {
-      if(neighbor_sum == 0) {
-        printf("\033[2m");
-      } else {
-        printf("\033[34;1m");
-      }
-    } else {
-      if(val == 1) {
-        printf("\033[31m");
-      }
+  bool pop(WorkUnit & unit) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if(units.empty()) {
+      return false;
     }
-    if(visited_next != NULL ) {
-      printf("\033[4m");
+    unit = units.back();
+    units.pop_back();
+    return true;
+  }
+
+  bool steal(WorkUnit & unit) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if(units.empty()) {
+      return false;
     }
-    printf("%3d,%3d", val, neighbor_sum);
-    if(val <= 1)
-      printf("\033[0m");
+    unit = units.front();
+    units.pop_front();
+    return true;
   }
 };
 
-/*
-class Completed(const std::string & filename) {
+// Part of a walk of a max_depth board, given away partway through by the Board
+// walking it (see Board::donate_walk()). Squares are (y << 16) + x. The values
+// 2, 3, ... go on prefix in order, then each of candidates in turn gets the
+// next value and is walked from there.
+class WalkUnit {
 public:
-
-private:
-  
+  WorkUnit board;
+  std::vector<u32> prefix;
+  std::vector<u32> candidates;
+  // Counts the donor's WalkUnits still to finish (see BoardPool::run_unit()).
+  std::atomic<u32> * donor_running;
 };
-*/
 
-#define ITERATE(list_name, iterator_name) \
-  for(Square * iterator_name = list_name##_list.list_name##_next; \
-      iterator_name->list_name##_next != NULL; \
-      iterator_name = iterator_name->list_name##_next)
-#define ITERATE_INDEX(list_name, index, iterator_name) \
-  for(Square * iterator_name = list_name##_list[index].list_name##_next; \
-      iterator_name->list_name##_next != NULL; \
-      iterator_name = iterator_name->list_name##_next)
-
-class Board {
+// WalkUnits waiting for an idle thread, shared by a whole BoardPool. Without
+// these, a pool spends the end of a search waiting on the handful of boards
+// whose walks take minutes, one thread each.
+class WalkQueue {
 private:
-  static const u32 board_size = 1001; // MUST BE ODD (so refletion works)
-  static const u32 board_mid = board_size/2;
-  static const u32 max_neighbor_sums = 2000; //Paying memory for safety/speed.
-  static const u16 max_depth_computable = 20; // Not enough time in the universe.
-  static const u32 buf_len = 16*(max_depth_computable + 1); //Generous estimate.
+  std::deque<WalkUnit> units;
+  std::mutex mutex;
 
-  Square squares[board_size][board_size];
-  char packed_repr_buffs[8][buf_len];
-  std::set<std::string> walked_boards;
-  u16 best_scores[max_depth_computable + 1];
-  std::vector<std::string> best_solutions;
-  u64 total_board_counts[9] = {0, 0, 5, 128, 7767, 501823, 0, 0, 0};
-  u64 checked_board_counts[max_depth_computable + 1];
+public:
+  std::atomic<u64> * pending; // Shared with the WorkQueues.
+  std::atomic<u32> idle; // Threads with nothing to do.
+  std::atomic<u32> queued;
 
-  // It's highly unusual to keep linked lists this way, with guards at either
-  // end of the list. However, I'm shooting for a fast run here, so I want to
-  // avoid inserts and deletes with special cases. This way, insert and delete
-  // have no ifs, so code is simpler and no chance of a pipeline stall.
-  Square neighbor_sums_list[max_neighbor_sums];
-  Square neighbor_sums_ends[max_neighbor_sums];
-  Square one_point_squares_list;
-  Square one_point_squares_end;
-  Square visited_list;
-  Square visited_end;
+  WalkQueue() : pending(NULL), idle(0), queued(0) {}
 
-  u16 max_depth = 4;
-  u32 one_point_count;
+  // True if there's an idle thread that nothing has been queued for yet.
+  // Checked in the middle of walks, so it doesn't take the lock.
+  bool wanted() {
+    return idle.load(std::memory_order_relaxed) >
+           queued.load(std::memory_order_relaxed);
+  }
 
-  double start_time;
+  void push(WalkUnit & unit) {
+    (*pending)++;
+    std::lock_guard<std::mutex> lock(mutex);
+    units.push_back(std::move(unit));
+    queued++;
+  }
 
-  s16 dydx[8][2] = {
-    {-1,-1}, {-1, 0}, {-1, 1},
-    { 0,-1},          { 0, 1},
-    { 1,-1}, { 1, 0}, { 1, 1}};
+  bool pop(WalkUnit & unit) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if(units.empty()) {
+      return false;
+    }
+    unit = std::move(units.front());
+    units.pop_front();
+    queued--;
+    return true;
+  }
+};
 
-  void get_visited_extents(u16 & min_x, u16 & min_y, u16 & max_x, u16 & max_y) {
-    min_x = u16_max, max_x = u16_min;
-    min_y = u16_max, max_y = u16_min;
+// The 8 symmetries of a set of stones, numbered (and keyed) the same way as in
+// Board::check_and_update_walked_set(). The orderly search needs to know where
+// each individual stone lands, not just the sorted key, so this keeps them in
+// the order given.
+class StoneSymmetries {
+public:
+  s32 corner_x[8]; // Smallest x and y of the stones under each symmetry.
+  s32 corner_y[8];
+  u32 packed[8][max_depth_computable]; // [symmetry][stone]
+  u128 keys[8];
+  u128 canonical_key;
+  u32 canonical_image; // The first symmetry with the canonical key.
 
-    ITERATE(visited, iter) {
-      min_x = std::min(min_x, iter->x);
-      max_x = std::max(max_x, iter->x);
-      min_y = std::min(min_y, iter->y);
-      max_y = std::max(max_y, iter->y);
+  // Reflections only, so there's no need for a center: the corner takes care
+  // of translation.
+  static void transform(u32 image, s32 x, s32 y, s32 & tx, s32 & ty) {
+    switch(image) {
+      case 0: tx =  x; ty =  y; break;
+      case 1: tx =  x; ty = -y; break;
+      case 2: tx = -x; ty = -y; break;
+      case 3: tx = -x; ty =  y; break;
+      case 4: tx =  y; ty = -x; break;
+      case 5: tx = -y; ty = -x; break;
+      case 6: tx = -y; ty =  x; break;
+      case 7: tx =  y; ty =  x; break;
+      default: abort(); // There are only 8.
     }
   }
 
-  void get_one_point_extents(u16 & min_x, u16 & min_y, u16 & max_x, u16 & max_y) {
-    min_x = u16_max, max_x = u16_min;
-    min_y = u16_max, max_y = u16_min;
+  // Only so _all_iterative()'s frames can hold one.
+  StoneSymmetries() {}
 
-    ITERATE(one_point_squares, iter) {
-      min_x = std::min(min_x, iter->x);
-      max_x = std::max(max_x, iter->x);
-      min_y = std::min(min_y, iter->y);
-      max_y = std::max(max_y, iter->y);
+  // build() for the stone count, so that its loops unroll.
+  StoneSymmetries(const WorkUnit & stones) {
+    switch(stones.stone_count) {
+      case 2: build<2>(stones); break;
+      case 3: build<3>(stones); break;
+      case 4: build<4>(stones); break;
+      case 5: build<5>(stones); break;
+      case 6: build<6>(stones); break;
+      case 7: build<7>(stones); break;
+      case 8: build<8>(stones); break;
+      default: build<0>(stones); break;
     }
   }
 
-  void _push(u16 x, u16 y, u32 val) {
-    Square * square = &squares[y][x];
-    visited_list.visited_insert(square);
-    square->val = val;
+  // For fixed_count stones, or stones.stone_count if it's 0.
+  template <u32 fixed_count>
+  void build(const WorkUnit & stones) {
+    u32 count = fixed_count != 0 ? fixed_count : stones.stone_count;
+    s32 min_x = s32_max, min_y = s32_max, max_x = s32_min, max_y = s32_min;
+    for(u32 j=0; j<count; j++) {
+      min_x = std::min<s32>(min_x, stones.stones[j][0]);
+      min_y = std::min<s32>(min_y, stones.stones[j][1]);
+      max_x = std::max<s32>(max_x, stones.stones[j][0]);
+      max_y = std::max<s32>(max_y, stones.stones[j][1]);
+    }
     for(u32 i=0; i<8; i++) {
-      u16 neighbor_y = y + dydx[i][0];
-      u16 neighbor_x = x + dydx[i][1];
-      Square * neighbor_square = &squares[neighbor_y][neighbor_x];
-      if(neighbor_square->val == 0) {
-        u32 old_sum = neighbor_square->neighbor_sum;
-        u32 new_sum = old_sum + val;
-        neighbor_square->neighbor_sum = new_sum;
-        if(old_sum > 0) {
-          neighbor_square->neighbor_sums_erase();
-        }
-        neighbor_sums_list[new_sum].neighbor_sums_insert(neighbor_square);
+      // Each symmetry only swaps and negates coordinates, so the smallest x
+      // and y under it come from one or other corner of the bounding box.
+      s32 tx, ty, far_tx, far_ty;
+      transform(i, min_x, min_y, tx, ty);
+      transform(i, max_x, max_y, far_tx, far_ty);
+      corner_x[i] = std::min(tx, far_tx);
+      corner_y[i] = std::min(ty, far_ty);
+      u32 sorted[fixed_count != 0 ? fixed_count : max_depth_computable];
+      for(u32 j=0; j<count; j++) {
+        transform(i, stones.stones[j][0], stones.stones[j][1], tx, ty);
+        packed[i][j] = sorted[j] =
+            ((ty - corner_y[i]) << 8) + (tx - corner_x[i]);
+      }
+      // load() turns away boards with more stones than a key holds, but if one
+      // got here anyway, the networks only sort max_key_stones.
+      if(fixed_count != 0) {
+        sort_key_list_fixed<fixed_count>(sorted);
+      } else if(count > max_key_stones) {
+        std::sort(sorted, sorted + count);
+      } else {
+        sort_key_list(sorted, count);
       }
+      keys[i] = repr_key(sorted, count);
     }
+    canonical_image = 0;
+    for(u32 i=1; i<8; i++) {
+      if(keys[i] < keys[canonical_image]) {
+        canonical_image = i;
+      }
+    }
+    canonical_key = keys[canonical_image];
+  }
+
+  // True if this symmetry gives the canonical key. These are the canonical
+  // image combined with each symmetry that maps the stones onto themselves
+  // (give or take a translation), so comparing a point's position under all
+  // of them compares its position across its orbit.
+  bool is_automorphism(u32 image) {
+    return keys[image] == canonical_key;
   }
 
-  void _pop(u16 x, u16 y) {
-    Square * square = &squares[y][x];
-    u16 val = square->val;
+  // Where any point (stone or not) lands under a symmetry, relative to the
+  // stones' corner, as one comparable number: y first, then x.
+  s64 offset(u32 image, u16 x, u16 y) {
+    s32 tx, ty;
+    transform(image, x, y, tx, ty);
+    return ((s64)(ty - corner_y[image]) << 32) + (tx - corner_x[image]);
+  }
+};
 
-    square->val = 0;
-    for(u32 i=0; i<8; i++) {
-      u16 neighbor_y = y + dydx[i][0];
-      u16 neighbor_x = x + dydx[i][1];
-      Square * neighbor_square = &squares[neighbor_y][neighbor_x];
-      if(neighbor_square->val == 0) {
-        u16 old_val = neighbor_square->neighbor_sum;
-        u16 new_val = old_val - val;
-        neighbor_square->neighbor_sum = new_val;
-        neighbor_square->neighbor_sums_erase();
-        if(new_val > 0) {
-          neighbor_sums_list[new_val].neighbor_sums_insert(neighbor_square);
-        }
-      }
+// Whether text is a packed board string (see Board::load()) of stone_count
+// stones, each inside its WIDTHxHEIGHT. For strings that came from somewhere
+// else, like a client or a checkpoint file, before they're kept.
+bool is_board_string(const std::string & text, u32 stone_count) {
+  auto parse_hex = [](const std::string & field, u32 & value) {
+    if(field.empty() || field.size() > 4 ||
+       field.find_first_not_of("0123456789abcdef") != std::string::npos) {
+      return false;
     }
+    value = strtoul(field.c_str(), NULL, 16);
+    return true;
+  };
+  std::vector<std::string> fields = split(text, '|');
+  if(fields.size() != stone_count + 1) {
+    return false;
   }
-
-  inline u32 pack(u16 x, u16 y, u16 min_x, u16 min_y) {
-    return ((y-min_y)<<8) + (x-min_x);
+  std::vector<std::string> dimensions = split(fields[0], 'x');
+  u32 width, height;
+  if(dimensions.size() != 2 || !parse_hex(dimensions[0], width) ||
+     !parse_hex(dimensions[1], height)) {
+    return false;
+  }
+  for(u32 i=1; i<fields.size(); i++) {
+    u32 stone;
+    if(!parse_hex(fields[i], stone) || (stone & 0xff) >= width ||
+       (stone >> 8) >= height) {
+      return false;
+    }
   }
+  return true;
+}
 
-  inline void unpack(u32 packed, u16 & x, u16 & y, u16 min_x, u16 min_y) {
-    y = (packed>>8) + min_y;
-    x = (packed&0xff) + min_x;
+// Packed board strings at max_depth, waiting for a client to walk them. It's
+// bounded so that the search filling it can't run arbitrarily far ahead of
+// the clients draining it.
+class LeafQueue {
+private:
+  static const u32 max_queued = 100000;
+
+  std::deque<std::string> boards;
+  std::mutex mutex;
+  std::condition_variable not_full;
+  bool finished;
+
+public:
+  enum PopResult { popped, empty, exhausted };
+
+  LeafQueue() : finished(false) {}
+
+  void push(const std::string & board) {
+    std::unique_lock<std::mutex> lock(mutex);
+    not_full.wait(lock, [this]{ return boards.size() < max_queued; });
+    boards.push_back(board);
   }
 
-  inline void u32_to_buf(
-      char buf[], u32 repr_list[], u32 count, u16 span_x, u16 span_y) {
-    std::sort(repr_list, repr_list + count);
+  // Called once the search has pushed its last board.
+  void finish() {
+    std::lock_guard<std::mutex> lock(mutex);
+    finished = true;
+  }
 
-    //TODO: faster to format straight into the output string?
-    u32 len = snprintf(buf, buf_len, "%xx%x", span_x, span_y);
-    for(u32 i=0; i<count; i++) {
-      // I'm not counting total 
-      len += snprintf(buf+len, buf_len-len, "|%x", repr_list[i]);
+  PopResult pop(std::string & board) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if(boards.empty()) {
+      return finished ? exhausted : empty;
     }
+    board = boards.front();
+    boards.pop_front();
+    not_full.notify_one();
+    return popped;
   }
 
-  //Returns true if first string is already in walked_board_set.
-  //Setting do_all to true forces the generation of all strings. The
-  //values of strings1-7 are garbage if do_all==false and retval==false.
-  bool check_and_update_walked_set(bool do_all=false, bool skip_update=false) {
-    u32 repr_list[8][max_depth_computable];
-    u32 repr_list_next=0;
-    u16 min_x, min_y, max_x, max_y;
+  u64 size() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return boards.size();
+  }
+};
+
+// The set of already-walked boards, by canonical key. Boards on separate
+// threads share one, under the lock. It's kept in boards unless it's been
+// moved out to files with use_files().
+//
+// About half the keys asked about are new, so filter goes in front: whatever
+// it's never had added is new for sure, and goes straight in with
+// insert_new().
+class WalkedBoards {
+public:
+  KeySet boards;
+  MappedKeySet * mapped;
+  BloomFilter filter;
+  std::mutex mutex;
 
-    get_one_point_extents(min_x, min_y, max_x, max_y);
-    u16 span_x = 1 + max_x - min_x;
-    u16 span_y = 1 + max_y - min_y;
-    ITERATE(one_point_squares, iter) {
-      u32 x = (u32)(iter->x);
-      u32 y = (u32)(iter->y);
+  u64 lookups;
+  u64 filtered; // Known new from filter alone.
+  u64 false_positives; // New, but filter couldn't tell.
 
-      repr_list[0][repr_list_next++] = pack(x, y, min_x, min_y);
-    }
+  WalkedBoards() :
+      mapped(NULL),
+      lookups(0),
+      filtered(0),
+      false_positives(0)
+  {
+  }
 
-    u32_to_buf(
-      packed_repr_buffs[0], repr_list[0], repr_list_next, span_x, span_y);
+  ~WalkedBoards() {
+    delete mapped;
+  }
 
-    //TODO: If the first one is already in the cache, quit early.
+  // Only before anything's been inserted.
+  void use_files(const char * directory) {
+    mapped = new MappedKeySet(directory);
+  }
 
-    std::string str_of_buf(packed_repr_buffs[0]);
-    if(!do_all && walked_boards.find(str_of_buf) != walked_boards.end()) {
+  bool insert(u128 key) {
+    lookups++;
+    if(!filter.may_contain(key)) {
+      filter.add(key);
+      filtered++;
+      insert_new(key);
       return true;
     }
-    if(!skip_update) {
-      walked_boards.insert(str_of_buf);
+    if(!(mapped != NULL ? mapped->insert(key) : boards.insert(key))) {
+      return false;
     }
+    filter.add(key);
+    false_positives++;
+    return true;
+  }
 
-    /*
-    As the saying goes, the algorithm to do this is very nasty. In fact,
-    you might want to mug someone with it. Let's say that we start with 
-    the three stones labeled 0 on a 15x15 board:
-
-      0123456789abcde
-    0 +++++++++++++++
-    1 ++++66+++77++++
-    2 ++++++6+7++++++
-    3 +++++++++++++++
-    4 +1+++++++++++2+
-    5 +1+++++++++++2+
-    6 ++1+++++++++2++
-    7 +++++++++++++++
-    8 ++0+++++++++3++
-    9 +0+++++++++++3+
-    a +0+++++++++++3+
-    b +++++++++++++++
-    c ++++++5+4++++++
-    d ++++55+++44++++
-
-    min_x=1, min_y=8, max_x=2, max_y=10.
-
-    As we go through the 8 permutations of these three stones, the smallest
-    x in the triple will sometimes be min_x (rotations 0 and 1), but it may
-    also be min_y (like in rotations 4 and 7), or the reflections of max_x
-    or max_y. In rotations 2 and 3, the min x we need for computing offsets
-    in pack() is 12, which is the reflection (or "inverse") of max_x.
-
-    Maybe there's a way to pack this into a loop inside of ITERATE, but I
-    didn't see it.
-    */
-
-    repr_list_next = 0;
-    u16 max_x_inv = board_size - max_x - 1;
-    u16 max_y_inv = board_size - max_y - 1;
-    ITERATE(one_point_squares, iter) {
-      u16 x = iter->x;
-      u16 y = iter->y;
-      //We've already done [y][x], so we output nothing to repr_list[0].
-      //Let's reflect about y=board_mid:
-      y = board_size - y - 1;
-      repr_list[1][repr_list_next] = pack(x, y, min_x, max_y_inv);
-      //Reflect about x=board_mid axis:
-      x = board_size - x - 1;
-      repr_list[2][repr_list_next] = pack(x, y, max_x_inv, max_y_inv);
-      //Reflect about y=board_mid again:
-      y = board_size - y - 1;
-      repr_list[3][repr_list_next] = pack(x, y, max_x_inv, min_y);
-
-      //Now we do a reflection about x=y:
-      std::swap(x, y);
-      repr_list[4][repr_list_next] = pack(x, y, min_y, max_x_inv);
-
-      //Reflect about x=board_mid (continuing clockwise.):
-      x = board_size - x - 1;
-      repr_list[5][repr_list_next] = pack(x, y, max_y_inv, max_x_inv);
-      //Reflect about y=board_mid
-      y = board_size - y - 1;
-      repr_list[6][repr_list_next] = pack(x, y, max_y_inv, min_x);
-      //Reflect about x=board_mid
-      x = board_size - x - 1;
-      repr_list[7][repr_list_next] = pack(x, y, min_y, min_x);
-
-      repr_list_next++;
+  void insert_new(u128 key) {
+    if(mapped != NULL) {
+      mapped->insert_new(key);
+    } else {
+      boards.insert_new(key);
     }
-    for(u32 i=1; i<8; i++) {
-      //TODO: is it faster to do two i loops w/o the if, or is the optimizer
-      //      getting it?
-      if(i<4) {
-        u32_to_buf(
-          packed_repr_buffs[i], repr_list[i], repr_list_next, span_x, span_y);
-      } else {
-        u32_to_buf(
-          packed_repr_buffs[i], repr_list[i], repr_list_next, span_y, span_x);
-      }
+  }
 
-      if(!skip_update) {
-        walked_boards.insert(std::string(packed_repr_buffs[i]));
-      }
+  void report() {
+    if(lookups == 0) {
+      return;
     }
+    printf("walked boards: %lu lookups, %lu answered by the filter alone, "
+           "%lu false positives (%.3f%% of new boards)\n",
+           lookups, filtered, false_positives,
+           100.0 * false_positives / std::max<u64>(1, filtered + false_positives));
+  }
+};
 
-    return false;
+// A dedup shard and an Orchestrator talk over their own connection, with
+// these. The keys are u128s, each sent as two u64s, top half first.
+enum DedupMessageType {
+  // Orchestrator to shard: a u16 key count, then the keys.
+  dedup_query_message = 1,
+  // Shard to Orchestrator: the same count, then a u64 bit mask for each 64
+  // keys of the query, lowest bit first. A set bit means the key was new, and
+  // has been added.
+  dedup_answer_message = 2
+};
+
+// Orchestrator's walked set for the boards at max_depth, which is nearly all
+// of it, spread over dedup shard processes on other nodes (see
+// serve_dedup_shard()). Each shard owns a range of hashes, and only ever sees
+// the keys in it, so the set isn't kept whole anywhere.
+//
+// The search never waits on a shard. submit() adds a board to its shard's
+// next batch, and each shard has a thread of its own that sends the batches
+// off one at a time and hands the boards that came back new to new_board. The
+// search only stops if a shard falls a couple of batches behind. A batch goes
+// when it's full, or once it's been waiting max_wait seconds, so boards that
+// come slowly still reach the workers.
+//
+// A shard that goes away takes its keys with it, and they can't be rebuilt, so
+// that ends the run.
+class DedupShards {
+private:
+  static const u32 batch_keys = 1024;
+  static const u32 max_ready = 2; // Full batches waiting to go, per shard.
+  static constexpr double max_wait = 0.01;
+
+  class Batch {
+  public:
+    std::vector<u128> keys;
+    std::vector<std::string> boards;
+  };
+
+  class Shard {
+  public:
+    std::string address;
+    u16 port;
+    Client * client;
+    std::thread thread;
+
+    // Under the mutex.
+    std::mutex mutex;
+    std::condition_variable changed;
+    Batch filling;
+    double filling_since; // When the first board went into filling.
+    std::deque<Batch> ready;
+    bool finishing;
+
+    // Only the shard's thread touches these, until it's joined.
+    u64 queries;
+    u64 keys;
+    u64 duplicates;
+    double latency_total;
+    double latency_max;
+  };
+
+  std::vector<Shard *> shards;
+  std::function<void(const std::string &)> new_board;
+
+  // The top bits of the hash already pick the line of a BloomFilter and the
+  // shard of a MappedKeySet, and the bottom ones the slot in a KeySet, so the
+  // range comes from the hash mixed again. Otherwise every set on a shard
+  // would only ever see a sliver of those bits.
+  u32 shard_of(u128 key) {
+    u64 spread = KeySet::hash(key) * 0x9e3779b97f4a7c15UL;
+    return ((spread >> 32) * shards.size()) >> 32;
   }
 
-  void _walk(u16 val) {
-    // The order that we visit squares tends to be around the one-pointers first,
-    // then moving outward. The density of possible paths to trace is considerably
-    // higher near the one-pointers than around the perimeter. If I create this
-    // copy in the same order that the original is created, the rate at which
-    // computation is done will either accelerate or decelerate, depending on the
-    // order. This makes eta estimation very difficult.
-    //
-    // It's still terrible, but it's an improvement.
-    bool flipflop = true;
-    // I hate doing this copy. I'd love to find a way to skip it.
-    std::vector<Square *> neighbor_sums_equal_to_val;
-    ITERATE_INDEX(neighbor_sums, val, iter) {
-      if(flipflop) {
-        neighbor_sums_equal_to_val.push_back(iter);
-      } else {
-        //neighbor_sums_equal_to_val.push_front(iter);
+  // Call with the lock held.
+  void send_off(Shard * shard) {
+    shard->ready.push_back(std::move(shard->filling));
+    shard->filling = Batch();
+    shard->changed.notify_all();
+  }
+
+  void query_loop(Shard * shard) {
+    while(true) {
+      Batch batch;
+      {
+        std::unique_lock<std::mutex> lock(shard->mutex);
+        while(shard->ready.empty()) {
+          if(!shard->filling.keys.empty()) {
+            double waited = now() - shard->filling_since;
+            if(shard->finishing || waited >= max_wait) {
+              send_off(shard);
+              break;
+            }
+            shard->changed.wait_for(
+                lock, std::chrono::duration<double>(max_wait - waited));
+          } else if(shard->finishing) {
+            return;
+          } else {
+            shard->changed.wait(lock);
+          }
+        }
+        batch = std::move(shard->ready.front());
+        shard->ready.pop_front();
+        shard->changed.notify_all();
       }
-      //flipflop = ! flipflop;
-    }
 
-    if(neighbor_sums_equal_to_val.size() > 0) {
-      if(val > best_scores[one_point_count]) {
-        best_scores[one_point_count] = val;
-        printf("New best (%d stones): %d\n", one_point_count, val);
-        print(true, false, false);
-        best_solutions[one_point_count] = packed_repr_buffs[0];
-        printf("\n");
+      PayloadWriter query;
+      query.put_u16(batch.keys.size());
+      for(u128 key : batch.keys) {
+        query.put_u64(key >> 64);
+        query.put_u64(key);
+      }
+      double start = now();
+      shard->client->send_frame(dedup_query_message, query.payload);
+      u8 type;
+      std::string payload;
+      if(!shard->client->receive_frame(type, payload)) {
+        fprintf(stderr, "Lost the connection to dedup shard %s:%u\n",
+                shard->address.c_str(), shard->port);
+        exit(1);
+      }
+      double latency = now() - start;
+
+      PayloadReader reader(payload);
+      u16 count = reader.get_u16();
+      std::vector<u64> masks((count + 63) / 64);
+      for(u64 & mask : masks) {
+        mask = reader.get_u64();
       }
-      for(Square * square : neighbor_sums_equal_to_val) {
-        _push(square->x, square->y, val);
-        _walk(val+1);
-        _pop(square->x, square->y);
+      if(type != dedup_answer_message || !reader.finished() ||
+         count != batch.keys.size()) {
+        fprintf(stderr, "Dedup shard %s:%u sent a malformed answer\n",
+                shard->address.c_str(), shard->port);
+        exit(1);
       }
+      for(u32 i=0; i<count; i++) {
+        if(masks[i / 64] & ((u64)1 << (i % 64))) {
+          new_board(batch.boards[i]);
+        } else {
+          shard->duplicates++;
+        }
+      }
+      shard->queries++;
+      shard->keys += count;
+      shard->latency_total += latency;
+      shard->latency_max = std::max(shard->latency_max, latency);
     }
   }
 
-  void refresh_visited_list() {
-    while(visited_list.visited_next != &visited_end) {
-      visited_list.visited_next->visited_erase();
+public:
+  // addresses is HOST:PORT[,HOST:PORT...], one per shard. The same list, in
+  // the same order, always splits the keys up the same way.
+  DedupShards(const char * addresses,
+              std::function<void(const std::string &)> new_board_callback) :
+      new_board(new_board_callback)
+  {
+    std::string list(addresses);
+    size_t start = 0;
+    while(start <= list.size()) {
+      size_t end = std::min(list.find(',', start), list.size());
+      std::string entry = list.substr(start, end - start);
+      size_t colon = entry.rfind(':');
+      u16 port = colon == std::string::npos ? 0 :
+                 atoi(entry.c_str() + colon + 1);
+      if(port == 0) {
+        fprintf(stderr, "--dedup syntax: --dedup=HOST:PORT[,HOST:PORT...]\n");
+        exit(1);
+      }
+      Shard * shard = new Shard();
+      shard->address = entry.substr(0, colon);
+      shard->port = port;
+      shard->client = new Client(shard->address.c_str(), port);
+      shard->filling_since = 0;
+      shard->finishing = false;
+      shard->queries = 0;
+      shard->keys = 0;
+      shard->duplicates = 0;
+      shard->latency_total = 0;
+      shard->latency_max = 0;
+      shards.push_back(shard);
+      start = end + 1;
     }
+    for(Shard * shard : shards) {
+      shard->thread = std::thread(&DedupShards::query_loop, this, shard);
+    }
+  }
 
-    /*
-    if(visited_list.visited_next != &visited_end) {
-      printf("Fatal %d\n", __LINE__); exit(1);
+  ~DedupShards() {
+    for(Shard * shard : shards) {
+      delete shard->client;
+      delete shard;
     }
-    if(visited_end.visited_prev != &visited_list) {
-      printf("Fatal %d\n", __LINE__); exit(1);
+  }
+
+  // From the search thread only.
+  void submit(u128 key, const std::string & board) {
+    Shard * shard = shards[shard_of(key)];
+    std::unique_lock<std::mutex> lock(shard->mutex);
+    if(shard->filling.keys.empty()) {
+      // Starts the shard's thread timing it.
+      shard->filling_since = now();
+      shard->changed.notify_all();
     }
-    if(visited_list.visited_prev != NULL) {
-      printf("Fatal %d\n", __LINE__); exit(1);
+    shard->filling.keys.push_back(key);
+    shard->filling.boards.push_back(board);
+    if(shard->filling.keys.size() == batch_keys) {
+      shard->changed.wait(lock, [shard]{
+        return shard->ready.size() < max_ready;
+      });
+      // The thread may have sent it off itself while we waited.
+      if(!shard->filling.keys.empty()) {
+        send_off(shard);
+      }
     }
-    if(visited_end.visited_next != NULL) {
-      printf("Fatal %d\n", __LINE__); exit(1);
+  }
+
+  // Sends what's left, and waits for every answer. new_board has been called
+  // for every new board by the time this returns.
+  void finish() {
+    for(Shard * shard : shards) {
+      std::lock_guard<std::mutex> lock(shard->mutex);
+      shard->finishing = true;
+      shard->changed.notify_all();
     }
-    */
+    for(Shard * shard : shards) {
+      shard->thread.join();
+    }
+  }
 
-    ITERATE(one_point_squares, square) {
-      for(s16 dy=-1; dy<=1; dy++) {
-        for(s16 dx=-1; dx<=1; dx++) {
-          u16 x = square->x + dx;
-          u16 y = square->y + dy;
-          //printf("adding <%d, %d> back to visited list\n", dx, dy);
-          visited_list.visited_insert(&squares[y][x]);
-        }
-      }
+  // After finish().
+  void report() {
+    u64 queries = 0;
+    u64 keys = 0;
+    u64 duplicates = 0;
+    double latency_total = 0;
+    for(Shard * shard : shards) {
+      printf("dedup shard %s:%u: %lu keys in %lu queries, %lu duplicates, "
+             "%.3fms average latency, %.3fms at most\n",
+             shard->address.c_str(), shard->port, shard->keys, shard->queries,
+             shard->duplicates,
+             1000 * shard->latency_total / std::max<u64>(1, shard->queries),
+             1000 * shard->latency_max);
+      queries += shard->queries;
+      keys += shard->keys;
+      duplicates += shard->duplicates;
+      latency_total += shard->latency_total;
     }
+    printf("dedup shards: %lu duplicate walks avoided out of %lu boards "
+           "(%.1f%%), %.3fms average latency\n", duplicates, keys,
+           100.0 * duplicates / std::max<u64>(1, keys),
+           1000 * latency_total / std::max<u64>(1, queries));
   }
+};
 
-  void get_hours_minutes_seconds(double time,
-                                 u32 & hours, u32 & minutes, u32 & seconds) {
-    u32 s = time;
-    seconds = s % 60;
-    s /= 60;
-    minutes = s % 60;
-    s /= 60;
-    hours = s;
+// The progress of a BoardPool search, kept in a file so that a run that dies
+// can pick up where it left off. The search is cut into units, the subtrees
+// under the boards at unit_depth, and the file holds the canonical strings of
+// the units that are finished, the checked counts of those units alone, and
+// the best scores seen anywhere. On resume, finished units are skipped and
+// everything else (including the boards above unit_depth) is redone, so the
+// counts come out as if the run had never stopped.
+//
+// That only holds if each board is reached from just one unit, which is what
+// -o gives. Without it, the walked boards would have to be saved too, and
+// they'd have to match the finished units exactly.
+//
+// Search threads only take the lock to add to it. A writer thread copies it
+// under the lock every interval seconds, then writes the copy without it.
+class Checkpoint {
+private:
+  std::string filename;
+  u32 interval;
+  u16 max_depth;
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::thread writer;
+  bool stopping;
+  bool changed;
+
+  std::set<std::string> completed;
+  std::string completed_text; // The "done" lines for completed, in order.
+  u64 checked_counts[max_depth_computable + 1];
+  u16 best_scores[max_depth_computable + 1];
+  std::string best_solutions[max_depth_computable + 1];
+
+  // Call with the lock held.
+  std::string contents() {
+    std::string text = "max_depth " + std::to_string(max_depth) + "\n";
+    for(u32 i=2; i<=max_depth; i++) {
+      text += "checked " + std::to_string(i) + " " +
+              std::to_string(checked_counts[i]) + "\n";
+      if(best_scores[i] > 0) {
+        text += "best " + std::to_string(i) + " " +
+                std::to_string(best_scores[i]) + " " + best_solutions[i] + "\n";
+      }
+    }
+    return text + completed_text;
   }
 
-  void report_counts(bool force=true) {
-    if(!force) {
+  // Written next to the file and renamed over it, so a crash partway through
+  // leaves the last checkpoint as it was.
+  void write(const std::string & text) {
+    std::string temp_filename = filename + ".tmp";
+    FILE * file = fopen(temp_filename.c_str(), "w");
+    if(file == NULL) {
+      fprintf(stderr, "Unable to write %s\n", temp_filename.c_str());
       return;
     }
-    printf("\n");
-    for(u32 i=2; i<=max_depth; i++) {
-      printf("%d stone best: %d, checked: %lu/%lu, solution: %s\n",
-          i, best_scores[i], checked_board_counts[i], total_board_counts[i],
-          best_solutions[i].c_str());
-    }
+    fwrite(text.data(), 1, text.size(), file);
+    fflush(file);
+    fsync(fileno(file));
+    fclose(file);
+    rename(temp_filename.c_str(), filename.c_str());
+  }
 
-    u32 compute_on = (u16)5 < max_depth ? 5 : max_depth;
-    //Throws an inexplicable linker error on max_depth:
-    //u32 compute_on = std::min((u16)5, max_depth); // 5 is the best we have counts for.
-    double fraction_completed =
-        (double)checked_board_counts[compute_on]/total_board_counts[compute_on];
-    double elapsed_time = now() - start_time;
-    u32 elapsed_hours;
-    u32 elapsed_mins;
-    u32 elapsed_secs;
-    get_hours_minutes_seconds(
-        elapsed_time, elapsed_hours, elapsed_mins, elapsed_secs);
-    double eta = elapsed_time/fraction_completed - elapsed_time;
-    u32 eta_hours;
-    u32 eta_mins;
-    u32 eta_secs;
-    get_hours_minutes_seconds(eta, eta_hours, eta_mins, eta_secs);
-    printf("[%6.4f%%] in %dh%02dm%02ds. Eta: %dh%02dm%02ds\n",
-           fraction_completed*100.0, elapsed_hours, elapsed_mins, elapsed_secs,
-           eta_hours, eta_mins, eta_secs);
-    printf("fract:%0.6f t:%6.4f eta:%6.4f\n",
-           fraction_completed, elapsed_time, eta);
-    fflush(stdout);
+  void write_periodically() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while(!stopping) {
+      wake.wait_for(lock, std::chrono::seconds(interval),
+                    [this]{ return stopping; });
+      if(changed && !stopping) {
+        std::string text = contents();
+        changed = false;
+        lock.unlock();
+        write(text);
+        lock.lock();
+      }
+    }
   }
 
 public:
-  Board(u16 max_depth_requested) :
-      one_point_count(0),
-      max_depth(max_depth_requested)
+  const u16 unit_depth;
+
+  Checkpoint(const std::string & filename_requested, u32 interval_requested,
+             u16 max_depth_requested) :
+      filename(filename_requested),
+      interval(interval_requested),
+      max_depth(max_depth_requested),
+      stopping(false),
+      changed(false),
+      // Deep enough for thousands of units on a long run, but not so deep
+      // that the list of them gets big.
+      unit_depth(std::max(2, max_depth_requested - 2))
   {
-    start_time = now();
-    for(u32 y=0; y<board_size; y++) {
-      for(u32 x=0; x<board_size; x++) {
-        squares[y][x].x = x;
-        squares[y][x].y = y;
-      }
-    }
+    std::fill(checked_counts, checked_counts + max_depth_computable + 1, 0);
     std::fill(best_scores, best_scores + max_depth_computable + 1, 0);
-    std::fill(checked_board_counts,
-              checked_board_counts + max_depth_computable + 1, 0);
-    best_solutions.reserve(max_depth_computable+1);
+  }
+
+  ~Checkpoint() {
+    finish();
+  }
 
-    one_point_squares_list.one_point_squares_next = &one_point_squares_end;
-    one_point_squares_end.one_point_squares_prev = &one_point_squares_list;
+  // Reads in a checkpoint written by an earlier run. Exits on anything it
+  // doesn't understand rather than guessing.
+  void load(const std::string & resume_filename) {
+    FILE * file = fopen(resume_filename.c_str(), "r");
+    if(file == NULL) {
+      fprintf(stderr, "Unable to read %s\n", resume_filename.c_str());
+      exit(1);
+    }
+    // Plain decimal digits, few enough that they can't overflow, and at most
+    // limit.
+    auto parse_decimal = [](const std::string & field, u64 limit, u64 & value) {
+      if(field.empty() || field.size() > 19 ||
+         field.find_first_not_of("0123456789") != std::string::npos) {
+        return false;
+      }
+      value = strtoul(field.c_str(), NULL, 10);
+      return value <= limit;
+    };
+    auto parse_stone_count = [&](const std::string & field, u64 & value) {
+      return parse_decimal(field, max_depth, value) && value >= 2;
+    };
+    char line[1000];
+    while(fgets(line, sizeof(line), file) != NULL) {
+      std::string text(line);
+      if(!text.empty() && text.back() == '\n') {
+        text.pop_back();
+      }
+      std::vector<std::string> fields = split(text, ' ');
+      u64 depth, stone_count, count, score;
+      if(fields[0] == "max_depth" && fields.size() == 2 &&
+         parse_decimal(fields[1], u16_max, depth)) {
+        if(depth != max_depth) {
+          fprintf(stderr, "%s is from a run to depth %s\n",
+                  resume_filename.c_str(), fields[1].c_str());
+          exit(1);
+        }
+      } else if(fields[0] == "checked" && fields.size() == 3 &&
+                parse_stone_count(fields[1], stone_count) &&
+                parse_decimal(fields[2], u64_max, count)) {
+        checked_counts[stone_count] = count;
+      } else if(fields[0] == "best" && fields.size() == 4 &&
+                parse_stone_count(fields[1], stone_count) &&
+                parse_decimal(fields[2], u16_max, score) &&
+                is_board_string(fields[3], stone_count)) {
+        best_scores[stone_count] = score;
+        best_solutions[stone_count] = fields[3];
+      } else if(fields[0] == "done" && fields.size() == 2) {
+        completed.insert(fields[1]);
+        completed_text += text + "\n";
+      } else {
+        fprintf(stderr, "Can't make sense of \"%s\" in %s\n",
+                text.c_str(), resume_filename.c_str());
+        exit(1);
+      }
+    }
+    fclose(file);
+    printf("Resuming with %lu units done\n", completed.size());
+  }
 
-    visited_list.visited_next = &(visited_end);
-    visited_end.visited_prev = &(visited_list);
+  void start() {
+    writer = std::thread(&Checkpoint::write_periodically, this);
+  }
 
-    for(u32 i=0; i<max_neighbor_sums; i++) {
-      neighbor_sums_list[i].neighbor_sums_next = &(neighbor_sums_ends[i]);
-      neighbor_sums_ends[i].neighbor_sums_prev = &(neighbor_sums_list[i]);
+  // Stops the writer and writes whatever's left.
+  void finish() {
+    if(!writer.joinable()) {
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
     }
+    wake.notify_one();
+    writer.join();
+    write(contents());
+  }
+
+  bool is_completed(const std::string & unit) {
+    std::lock_guard<std::mutex> lock(mutex);
+    return completed.count(unit) > 0;
+  }
+
+  // counts are what the unit alone added to checked_board_counts.
+  void complete(const std::string & unit, const u64 * counts) {
+    std::lock_guard<std::mutex> lock(mutex);
+    completed.insert(unit);
+    completed_text += "done " + unit + "\n";
+    for(u32 i=0; i<=max_depth_computable; i++) {
+      checked_counts[i] += counts[i];
+    }
+    changed = true;
+  }
+
+  // Same tie rule as Board::merge().
+  void record_bests(const u16 * scores, const std::vector<std::string> & solutions) {
+    std::lock_guard<std::mutex> lock(mutex);
+    for(u32 i=0; i<=max_depth_computable; i++) {
+      if(scores[i] > best_scores[i] ||
+         (scores[i] == best_scores[i] && solutions[i] < best_solutions[i])) {
+        best_scores[i] = scores[i];
+        best_solutions[i] = solutions[i];
+        changed = true;
+      }
+    }
+  }
+
+  // Only for before the search starts.
+  void get_results(u64 * counts, u16 * scores, std::string * solutions) {
+    std::copy(checked_counts, checked_counts + max_depth_computable + 1, counts);
+    std::copy(best_scores, best_scores + max_depth_computable + 1, scores);
+    std::copy(best_solutions, best_solutions + max_depth_computable + 1,
+              solutions);
+  }
+};
+
+#define ITERATE(list_name, iterator_name) \
+  for(u32 iterator_name = list_name##_next[list_name##_list]; \
+      list_name##_next[iterator_name] != no_link; \
+      iterator_name = list_name##_next[iterator_name])
+
+class Board {
+public:
+  static const u32 board_size = 1001; // MUST BE ODD (so refletion works)
+  static const u32 board_mid = board_size/2;
+
+  // Update neighbor sums with update_neighbor_sums() rather than one at a
+  // time. For every Board at once; only set it if simd_available(). It's off
+  // by default because, so far, it's slower: a push is usually next to the
+  // one before it, so its wide loads overlap the narrow stores that one just
+  // made, and the CPU can't forward those. See bench_walk().
+  static inline bool simd_neighbors = false;
+
+private:
+  static const u32 max_neighbor_sums = 2000; //Paying memory for safety/speed.
+  static const u32 buf_len = 16*(max_depth_computable + 1); //Generous estimate.
+
+  // Coordinates run from 0 to board_size, but only a window_size square window
+  // of the board, with its corner at window_x and window_y, is kept in memory.
+  // It starts out small and centered on board_mid, and doubles whenever
+  // something gets too close to its edge (see window_margin).
+  static const u32 first_window_shift = 6;
+  static const u32 max_window_shift = 9;
+  u32 window_shift;
+  u32 window_size;
+  u16 window_x;
+  u16 window_y;
+
+  // The outermost ring of the window is edge_val, so it's never empty and
+  // never gets a neighbor sum. The rest of the first window_margin rings are
+  // marked in near_edge. Placing a value there sets window_overflow: the walk
+  // might have gone on past the edge, so it's thrown out and rerun on a bigger
+  // window. Stones stay at least stone_margin in, so that the 3x3 around them
+  // in the visited list, and the 5x5 around that from _expand(), stay inside.
+  static const u16 edge_val = 0xffff;
+  static const u32 window_margin = 3;
+  static const u32 stone_margin = window_margin + 1;
+  std::vector<u8> near_edge;
+  bool window_overflow;
+  // Set along with window_overflow when a walk stops to give part of itself
+  // away on a window that could still grow (see donate_walk()).
+  bool donation_needs_room;
+
+  // The guards of the lists, numbered after the squares.
+  u32 square_count;
+  u32 one_point_squares_list;
+  u32 one_point_squares_end;
+  u32 visited_list;
+  u32 visited_end;
+
+  // The squares, kept as one array per field rather than an array of structs.
+  // A walk mostly touches val and neighbor_sum of a square and its neighbors,
+  // which this way sit in three short runs of memory instead of eight widely
+  // spaced structs.
+  std::vector<u16> square_val;
+  std::vector<u16> square_neighbor_sum;
+  // Spare entries past the last square in both, for update_neighbor_sums().
+  static const u32 simd_padding = 8;
+
+  // Scratch space, so the search doesn't allocate once it's warmed up. There's
+  // one of each per level of recursion that can be live at once: _all() is
+  // only ever running one call per depth.
+  std::vector<u32> expand_candidates[max_depth_computable + 1];
+  std::vector<u32> symmetric_visits;
+  char packed_repr_buffs[8][buf_len];
+  // The stones under each of the 8 symmetries (see transform_stone()), as
+  // (y << 16) + x, kept sorted by push() and pop(). The smallest y under each
+  // is the first stone's, and image_min_x has the smallest x.
+  u32 image_stones[8][max_depth_computable];
+  u16 image_min_x[8];
+  u128 canonical_key;
+  u32 canonical_image;
+  // Made on first use (see walked()), so Boards that never look anything up,
+  // like a BoardPool's or a Worker's, don't each carry a set and a filter.
+  WalkedBoards * own_walked_boards;
+  WalkedBoards * walked_boards;
+  u16 best_scores[max_depth_computable + 1];
+  std::vector<std::string> best_solutions;
+  u64 total_board_counts[9] = {0, 0, 5, 128, 7767, 502068, 0, 0, 0};
+  u64 checked_board_counts[max_depth_computable + 1];
+
+  // It's highly unusual to keep linked lists this way, with guards at either
+  // end of the list. However, I'm shooting for a fast run here, so I want to
+  // avoid inserts and deletes with special cases. This way, insert and delete
+  // have no ifs, so code is simpler and no chance of a pipeline stall.
+  DEFINE_LIST(one_point_squares);
+  DEFINE_LIST(visited);
+
+  // The squares with each neighbor sum, in arrays rather than lists, and
+  // where each square sits in its bucket (no_link if it's in none). Squares
+  // with values on them stay in the bucket for their value; they're never
+  // looked at again, since _walk() only ever moves on to higher buckets.
+  //
+  // _walk(val) used to copy its bucket before trying each square in it,
+  // because placing a value moves squares in and out of the bucket. Now _pop()
+  // undoes _push() exactly, putting every square back in the same slot, so
+  // _walk() can just index into the live bucket: it's the same as it was by
+  // the time the next square is read. bucket_undo[val] holds the slots that
+  // _push(square, val) took squares out of, for _pop() to put them back in.
+  // Stones come and go in any order, so push()/pop() don't rely on that.
+  std::vector<u32> buckets[max_neighbor_sums];
+  std::vector<u32> bucket_position;
+  u32 bucket_undo[max_neighbor_sums][8];
+
+  // The number of empty squares with each neighbor sum. Unlike the lists, a
+  // square stops counting once a value is placed on it.
+  u32 frontier_counts[max_neighbor_sums];
+
+  u16 max_depth = 4;
+  u32 one_point_count;
+  u16 walk_score;
+
+  // The symmetries that map the stones of the board being walked onto
+  // themselves, as a StoneSymmetries image plus the shift that puts the stones
+  // back where they were. Entry 0 is always the identity. walk_symmetries is
+  // a bitmask of the entries that also map every value placed so far onto
+  // itself; while any besides the identity are left, _walk() only needs to
+  // try one square out of each set of squares they map onto each other.
+  u32 stabilizer_images[8];
+  s32 stabilizer_shifts[8][2];
+  u32 stabilizer_size;
+  u32 walk_symmetries;
+
+  // The state of one level of _walk_iterative(): everything the recursive
+  // _walk() keeps in locals and in where it's going to return to.
+  class WalkFrame {
+  public:
+    u32 next; // The index in buckets[val] of the next candidate to try.
+    u32 candidate_count;
+    u32 symmetries; // walk_symmetries when this level started.
+    u32 square; // The candidate placed at the moment.
+  };
+  // Indexed by val, since there's only ever one level per value.
+  WalkFrame walk_frames[max_neighbor_sums];
+
+  // Set when this Board is in a BoardPool. While donating, the first
+  // donatable_levels levels of a walk copy their candidates to
+  // walk_snapshots, and when an idle thread wants work, the shallowest of
+  // them with candidates left gives those away. The copy is needed since
+  // deeper levels shuffle the buckets of shallower ones about (see
+  // bucket_erase()) until they're done.
+  WalkQueue * walk_queue;
+  bool donating;
+  static const u16 donatable_levels = 4;
+  std::vector<u32> walk_snapshots[max_neighbor_sums];
+  u64 donated_walks;
+  // WalkUnits given away from the WorkUnit this Board is running, and not yet
+  // finished. While running a WalkUnit, donation_counter is its
+  // donor_running instead, so that anything given away from it counts
+  // against the WorkUnit it came from.
+  std::atomic<u32> own_donations;
+  std::atomic<u32> * donation_counter;
+
+  // Likewise for _all_iterative(), indexed by depth. The candidates
+  // themselves are in expand_candidates[depth].
+  class AllFrame {
+  public:
+    u32 next;
+    u16 x; // The stone placed at the moment.
+    u16 y;
+    StoneSymmetries parent_symmetries;
+  };
+  AllFrame all_frames[max_depth_computable + 1];
+
+  // Use _walk() and _all() rather than their iterative versions. Both give the
+  // same results in the same order; this is kept around to check that, and to
+  // compare speeds.
+  bool recursive;
+
+  // Set when this Board is one of the workers in a BoardPool. Children of
+  // _all() at or above split_depth go to work_queue instead of recursing.
+  WorkQueue * work_queue;
+  u16 split_depth;
+  bool verbose;
+
+  // Generate boards in canonical order rather than checking walked_boards.
+  bool orderly;
+
+  // With prune, walks of boards at max_depth give up on any chain that can't
+  // reach the best score seen (or target_score, if that's higher). Ties still
+  // get walked, so the best solutions come out the same as an exact run.
+  bool prune;
+  bool pruning;
+  u16 target_score;
+  u64 walk_nodes;
+  u64 pruned_nodes;
+
+  // Set when this Board belongs to an Orchestrator. Boards at max_depth go
+  // here instead of being walked.
+  LeafQueue * leaf_queue;
+  // If set, the keys of those boards are checked with the dedup shards rather
+  // than walked_boards, and only the new ones reach leaf_queue.
+  DedupShards * leaf_dedup;
+
+  double start_time;
+#ifdef COUNT_MALLOCS
+  u64 reported_mallocs;
+#endif
+
+  s16 dydx[8][2] = {
+    {-1,-1}, {-1, 0}, {-1, 1},
+    { 0,-1},          { 0, 1},
+    { 1,-1}, { 1, 0}, { 1, 1}};
+  // dydx as offsets between square indices.
+  s32 neighbor_offsets[8];
+
+  u32 square_at(u16 x, u16 y) {
+    return ((y - window_y) << window_shift) + (x - window_x);
+  }
+
+  u16 x_of(u32 square) {
+    return window_x + (square & (window_size - 1));
+  }
+
+  u16 y_of(u32 square) {
+    return window_y + (square >> window_shift);
+  }
+
+  // True if (x, y) is at least margin squares in from the edge of the window.
+  bool is_inside_window(s32 x, s32 y, u32 margin) {
+    s32 low = margin;
+    s32 high = window_size - 1 - margin;
+    return x - window_x >= low && x - window_x <= high &&
+           y - window_y >= low && y - window_y <= high;
+  }
+
+  // Sets up an empty window of 2^shift squares on a side, centered on
+  // board_mid.
+  void build_window(u32 shift) {
+    if(shift > max_window_shift) {
+      fprintf(stderr, "Board outgrew the largest window (%d squares)\n",
+              1 << max_window_shift);
+      exit(1);
+    }
+    window_shift = shift;
+    window_size = 1 << shift;
+    window_x = window_y = board_mid - window_size/2;
+    window_overflow = false;
+    donation_needs_room = false;
+
+    square_count = window_size*window_size;
+    one_point_squares_list = square_count;
+    one_point_squares_end = one_point_squares_list + 1;
+    visited_list = one_point_squares_end + 1;
+    visited_end = visited_list + 1;
+    u32 link_count = visited_end + 1;
+
+    square_val.assign(square_count + simd_padding, 0);
+    square_neighbor_sum.assign(square_count + simd_padding, 0);
+    near_edge.assign(square_count, 0);
+    for(u32 y=0; y<window_size; y++) {
+      for(u32 x=0; x<window_size; x++) {
+        u32 ring = std::min(std::min(x, y), std::min(window_size - 1 - x,
+                                                     window_size - 1 - y));
+        u32 square = (y << window_shift) + x;
+        if(ring == 0) {
+          square_val[square] = edge_val;
+        } else if(ring < window_margin) {
+          near_edge[square] = 1;
+        }
+      }
+    }
+    for(u32 i=0; i<8; i++) {
+      neighbor_offsets[i] = dydx[i][0]*(s32)window_size + dydx[i][1];
+    }
+    std::fill(frontier_counts, frontier_counts + max_neighbor_sums, 0);
+
+    one_point_squares_next.assign(link_count, no_link);
+    one_point_squares_prev.assign(link_count, no_link);
+    visited_next.assign(link_count, no_link);
+    visited_prev.assign(link_count, no_link);
+
+    one_point_squares_init(one_point_squares_list, one_point_squares_end);
+    visited_init(visited_list, visited_end);
+    for(u32 i=0; i<max_neighbor_sums; i++) {
+      buckets[i].clear();
+    }
+    bucket_position.assign(square_count, no_link);
+  }
+
+  // Doubles the window. Only stones can be on the board; they're put back in
+  // the same order. The visited list starts over.
+  void grow_window() {
+    WorkUnit stones;
+    get_work_unit(stones);
+    build_window(window_shift + 1);
+    one_point_count = 0;
+    for(u32 i=0; i<stones.stone_count; i++) {
+      push(stones.stones[i][0], stones.stones[i][1]);
+    }
+  }
+
+  // Grows the window for another try at a walk that overflowed: all the way,
+  // if it stopped in order to give some of itself away.
+  void grow_window_for_rerun() {
+    u32 shift = donation_needs_room ? max_window_shift : window_shift + 1;
+    while(window_shift < shift) {
+      grow_window();
+    }
+  }
+
+  void get_visited_extents(u16 & min_x, u16 & min_y, u16 & max_x, u16 & max_y) {
+    min_x = u16_max, max_x = u16_min;
+    min_y = u16_max, max_y = u16_min;
+
+    ITERATE(visited, iter) {
+      min_x = std::min(min_x, x_of(iter));
+      max_x = std::max(max_x, x_of(iter));
+      min_y = std::min(min_y, y_of(iter));
+      max_y = std::max(max_y, y_of(iter));
+    }
+  }
+
+  void bucket_insert(u32 sum, u32 square) {
+    bucket_position[square] = buckets[sum].size();
+    buckets[sum].push_back(square);
+  }
+
+  // Swaps the last square in the bucket into this one's slot. Returns the
+  // slot.
+  u32 bucket_erase(u32 sum, u32 square) {
+    std::vector<u32> & bucket = buckets[sum];
+    u32 position = bucket_position[square];
+    u32 last = bucket.back();
+    bucket[position] = last;
+    bucket_position[last] = position;
+    bucket.pop_back();
+    bucket_position[square] = no_link;
+    return position;
+  }
+
+  // Undoes the bucket_erase() that returned position, as long as everything
+  // done to the bucket since has been undone too.
+  void bucket_unerase(u32 sum, u32 square, u32 position) {
+    std::vector<u32> & bucket = buckets[sum];
+    u32 moved = position < bucket.size() ? bucket[position] : square;
+    bucket_position[moved] = bucket.size();
+    bucket.push_back(moved);
+    bucket[position] = square;
+    bucket_position[square] = position;
+  }
+
+  // Undoes the last bucket_insert() into the bucket.
+  void bucket_uninsert(u32 sum) {
+    bucket_position[buckets[sum].back()] = no_link;
+    buckets[sum].pop_back();
+  }
+
+  // Adds delta to the neighbor sum of every empty neighbor of square at once,
+  // and returns a bit per neighbor that was updated, in dydx order.
+  //
+  // Each row of the 3x3 around square is 3 u16s in a row in square_val and
+  // square_neighbor_sum, so the rows above and below go in the two halves of
+  // one 256-bit register and the row through square in a 128-bit one, 8
+  // lanes a row. Only the first 3 lanes of each row are neighbors; the rest
+  // (and square itself) get 0 added and are stored back as they were, which
+  // is what simd_padding is for on the last row.
+  __attribute__((target("avx2")))
+  u32 update_neighbor_sums(u32 square, u16 delta) {
+    u32 top = square - window_size - 1;
+    u32 middle = top + window_size;
+    u32 bottom = middle + window_size;
+    u16 * vals = square_val.data();
+    u16 * sums = square_neighbor_sum.data();
+    __m256i outer_vals = _mm256_inserti128_si256(
+        _mm256_castsi128_si256(_mm_loadu_si128((__m128i *)(vals + top))),
+        _mm_loadu_si128((__m128i *)(vals + bottom)), 1);
+    __m256i outer_sums = _mm256_inserti128_si256(
+        _mm256_castsi128_si256(_mm_loadu_si128((__m128i *)(sums + top))),
+        _mm_loadu_si128((__m128i *)(sums + bottom)), 1);
+    __m128i inner_vals = _mm_loadu_si128((__m128i *)(vals + middle));
+    __m128i inner_sums = _mm_loadu_si128((__m128i *)(sums + middle));
+
+    __m256i outer_empty = _mm256_and_si256(
+        _mm256_cmpeq_epi16(outer_vals, _mm256_setzero_si256()),
+        _mm256_setr_epi16(-1, -1, -1, 0, 0, 0, 0, 0,
+                          -1, -1, -1, 0, 0, 0, 0, 0));
+    __m128i inner_empty = _mm_and_si128(
+        _mm_cmpeq_epi16(inner_vals, _mm_setzero_si128()),
+        _mm_setr_epi16(-1, 0, -1, 0, 0, 0, 0, 0));
+    outer_sums = _mm256_add_epi16(outer_sums, _mm256_and_si256(
+        outer_empty, _mm256_set1_epi16(delta)));
+    inner_sums = _mm_add_epi16(inner_sums, _mm_and_si128(
+        inner_empty, _mm_set1_epi16(delta)));
+    _mm_storeu_si128((__m128i *)(sums + top),
+                     _mm256_castsi256_si128(outer_sums));
+    _mm_storeu_si128((__m128i *)(sums + bottom),
+                     _mm256_extracti128_si256(outer_sums, 1));
+    _mm_storeu_si128((__m128i *)(sums + middle), inner_sums);
+
+    // A byte per lane, then the neighbors' bytes picked out in dydx order.
+    __m128i upper_bytes = _mm_packs_epi16(
+        _mm256_castsi256_si128(outer_empty), inner_empty);
+    __m128i lower_bytes = _mm_packs_epi16(
+        _mm256_extracti128_si256(outer_empty, 1), _mm_setzero_si128());
+    __m128i neighbor_bytes = _mm_or_si128(
+        _mm_shuffle_epi8(upper_bytes, _mm_setr_epi8(
+            0, 1, 2, 8, 10, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1)),
+        _mm_shuffle_epi8(lower_bytes, _mm_setr_epi8(
+            -1, -1, -1, -1, -1, 0, 1, 2, -1, -1, -1, -1, -1, -1, -1, -1)));
+    return _mm_movemask_epi8(neighbor_bytes);
+  }
+
+  // The bucket side of neighbor i of a square going from old_sum to new_sum
+  // when val is placed on the square.
+  void raise_neighbor(u32 neighbor_square, u32 old_sum, u32 new_sum,
+                      u32 val, u32 i) {
+    if(old_sum > 0) {
+      bucket_undo[val][i] = bucket_erase(old_sum, neighbor_square);
+      frontier_counts[old_sum]--;
+    }
+    bucket_insert(new_sum, neighbor_square);
+    frontier_counts[new_sum]++;
+  }
+
+  // And back again.
+  void lower_neighbor(u32 neighbor_square, u32 old_sum, u32 new_sum,
+                      u32 val, u32 i) {
+    bucket_uninsert(old_sum);
+    frontier_counts[old_sum]--;
+    if(new_sum > 0) {
+      bucket_unerase(new_sum, neighbor_square, bucket_undo[val][i]);
+      frontier_counts[new_sum]++;
+    }
+  }
+
+  void _push(u32 square, u32 val) {
+    visited_insert(visited_list, square);
+    window_overflow |= near_edge[square];
+    if(simd_neighbors) {
+      u32 updated = update_neighbor_sums(square, val);
+      square_val[square] = val;
+      while(updated != 0) {
+        u32 i = __builtin_ctz(updated);
+        updated &= updated - 1;
+        u32 neighbor_square = square + neighbor_offsets[i];
+        u32 new_sum = square_neighbor_sum[neighbor_square];
+        raise_neighbor(neighbor_square, new_sum - val, new_sum, val, i);
+      }
+      return;
+    }
+    square_val[square] = val;
+    for(u32 i=0; i<8; i++) {
+      u32 neighbor_square = square + neighbor_offsets[i];
+      if(square_val[neighbor_square] == 0) {
+        u32 old_sum = square_neighbor_sum[neighbor_square];
+        u32 new_sum = old_sum + val;
+        square_neighbor_sum[neighbor_square] = new_sum;
+        raise_neighbor(neighbor_square, old_sum, new_sum, val, i);
+      }
+    }
+  }
+
+  // Undoes the last _push(), leaving the buckets exactly as they were before
+  // it, down to the order of the squares in them. That means going through
+  // the neighbors backwards. The buckets don't depend on the sums, so with
+  // simd_neighbors the sums can all go back first.
+  void _pop(u32 square) {
+    u16 val = square_val[square];
+
+    if(simd_neighbors) {
+      u32 updated = update_neighbor_sums(square, -val);
+      square_val[square] = 0;
+      while(updated != 0) {
+        u32 i = 31 - __builtin_clz(updated);
+        updated ^= 1 << i;
+        u32 neighbor_square = square + neighbor_offsets[i];
+        u32 new_sum = square_neighbor_sum[neighbor_square];
+        lower_neighbor(neighbor_square, new_sum + val, new_sum, val, i);
+      }
+      return;
+    }
+    square_val[square] = 0;
+    for(s32 i=7; i>=0; i--) {
+      u32 neighbor_square = square + neighbor_offsets[i];
+      if(square_val[neighbor_square] == 0) {
+        u16 old_sum = square_neighbor_sum[neighbor_square];
+        u16 new_sum = old_sum - val;
+        square_neighbor_sum[neighbor_square] = new_sum;
+        lower_neighbor(neighbor_square, old_sum, new_sum, val, i);
+      }
+    }
+  }
+
+  inline u32 pack(u16 x, u16 y, u16 min_x, u16 min_y) {
+    return ((y-min_y)<<8) + (x-min_x);
+  }
+
+  inline void unpack(u32 packed, u16 & x, u16 & y, u16 min_x, u16 min_y) {
+    y = (packed>>8) + min_y;
+    x = (packed&0xff) + min_x;
+  }
+
+  // repr_list must already be sorted.
+  inline void u32_to_buf(
+      char buf[], u32 repr_list[], u32 count, u16 span_x, u16 span_y) {
+    //TODO: faster to format straight into the output string?
+    u32 len = snprintf(buf, buf_len, "%xx%x", span_x, span_y);
+    for(u32 i=0; i<count; i++) {
+      // I'm not counting total 
+      len += snprintf(buf+len, buf_len-len, "|%x", repr_list[i]);
+    }
+  }
+
+  // Where a stone lands under each of the 8 symmetries. They're all
+  // reflections about board_mid, so the results stay on the board.
+  /*
+  As the saying goes, the algorithm to do this is very nasty. In fact,
+  you might want to mug someone with it. Let's say that we start with 
+  the three stones labeled 0 on a 15x15 board:
+
+    0123456789abcde
+  0 +++++++++++++++
+  1 ++++66+++77++++
+  2 ++++++6+7++++++
+  3 +++++++++++++++
+  4 +1+++++++++++2+
+  5 +1+++++++++++2+
+  6 ++1+++++++++2++
+  7 +++++++++++++++
+  8 ++0+++++++++3++
+  9 +0+++++++++++3+
+  a +0+++++++++++3+
+  b +++++++++++++++
+  c ++++++5+4++++++
+  d ++++55+++44++++
+
+  min_x=1, min_y=8, max_x=2, max_y=10.
+
+  As we go through the 8 permutations of these three stones, the smallest
+  x in the triple will sometimes be min_x (rotations 0 and 1), but it may
+  also be min_y (like in rotations 4 and 7), or the reflections of max_x
+  or max_y. In rotations 2 and 3, the min x we need for computing offsets
+  in pack() is 12, which is the reflection (or "inverse") of max_x.
+
+  So rather than work out which extent goes with which rotation, push() and
+  pop() keep each image's stones in image_stones as they come and go, along
+  with the smallest x under that image, and the corner comes from those.
+  */
+  static void transform_stone(u32 image, u16 x, u16 y, u16 & tx, u16 & ty) {
+    u16 x_inv = board_size - x - 1;
+    u16 y_inv = board_size - y - 1;
+    switch(image) {
+      case 0: tx = x;     ty = y;     break;
+      case 1: tx = x;     ty = y_inv; break;
+      case 2: tx = x_inv; ty = y_inv; break;
+      case 3: tx = x_inv; ty = y;     break;
+      case 4: tx = y;     ty = x_inv; break;
+      case 5: tx = y_inv; ty = x_inv; break;
+      case 6: tx = y_inv; ty = x;     break;
+      case 7: tx = y;     ty = x;     break;
+    }
+  }
+
+  // Call before one_point_count goes up.
+  void add_image_stones(u16 x, u16 y) {
+    for(u32 i=0; i<8; i++) {
+      u16 tx, ty;
+      transform_stone(i, x, y, tx, ty);
+      u32 stone = ((u32)ty << 16) + tx;
+      u32 * stones = image_stones[i];
+      u32 j = one_point_count;
+      while(j > 0 && stones[j-1] > stone) {
+        stones[j] = stones[j-1];
+        j--;
+      }
+      stones[j] = stone;
+      image_min_x[i] = one_point_count == 0 ? tx : std::min(image_min_x[i], tx);
+    }
+  }
+
+  // Call before one_point_count goes down.
+  void remove_image_stones(u16 x, u16 y) {
+    for(u32 i=0; i<8; i++) {
+      u16 tx, ty;
+      transform_stone(i, x, y, tx, ty);
+      u32 stone = ((u32)ty << 16) + tx;
+      u32 * stones = image_stones[i];
+      u32 j = 0;
+      while(stones[j] != stone) {
+        j++;
+      }
+      for(; j+1<one_point_count; j++) {
+        stones[j] = stones[j+1];
+      }
+      image_min_x[i] = u16_max;
+      for(j=0; j+1<one_point_count; j++) {
+        image_min_x[i] = std::min<u16>(image_min_x[i], stones[j] & 0xffff);
+      }
+    }
+  }
+
+  // Sets canonical_key and canonical_image for a board of fixed_count stones,
+  // or of one_point_count if that's 0. With AVX2, image_key() does each image
+  // in one go whatever the count, so fixed_count only matters without it.
+  template <u32 fixed_count>
+  void find_canonical_key() {
+    u32 count = fixed_count != 0 ? fixed_count : one_point_count;
+    bool simd = using_simd();
+    u128 keys[8];
+
+    // Shifting every stone by the same corner doesn't change their order, so
+    // the image_stones lists are already sorted as packed lists.
+    canonical_image = 0;
+    for(u32 i=0; i<8; i++) {
+      u16 corner_y = image_stones[i][0] >> 16;
+      if(simd) {
+        keys[i] = image_key(image_stones[i], count, image_min_x[i], corner_y);
+      } else {
+        // Sized for any board rather than any key; load() keeps the two the
+        // same, but it's no place to overflow the stack if that ever slips.
+        u32 repr_list[max_depth_computable];
+        for(u32 j=0; j<count; j++) {
+          u32 stone = image_stones[i][j];
+          repr_list[j] = pack(stone & 0xffff, stone >> 16,
+                              image_min_x[i], corner_y);
+        }
+        keys[i] = repr_key(repr_list, count);
+      }
+      if(keys[i] < keys[canonical_image]) {
+        canonical_image = i;
+      }
+    }
+    canonical_key = keys[canonical_image];
+  }
+
+  // The walked set in use: the pool's, or this Board's own, made now if it
+  // hasn't been yet.
+  WalkedBoards * walked() {
+    if(walked_boards == NULL) {
+      own_walked_boards = new WalkedBoards();
+      walked_boards = own_walked_boards;
+    }
+    return walked_boards;
+  }
+
+  //Returns true if the board is already in walked_boards. Otherwise, adds its
+  //canonical key (unless skip_update) and returns false. The canonical key is
+  //the smallest of the keys of the 8 symmetries, so every symmetry of a board
+  //maps to the same one; it's left in canonical_key, and the index of the
+  //symmetry it came from in canonical_image. Setting do_all to true skips the
+  //lookup and also writes the text form of all 8 to packed_repr_buffs; that's
+  //only needed for printing.
+  bool check_and_update_walked_set(bool do_all=false, bool skip_update=false) {
+    u32 repr_list[8][max_depth_computable];
+    u32 count = one_point_count;
+
+    // The stone count is the same for every image, so it's picked once here,
+    // and the loops over the stones in find_canonical_key() are unrolled for
+    // it. Every depth the search can go to has its own.
+    switch(count) {
+      case 2: find_canonical_key<2>(); break;
+      case 3: find_canonical_key<3>(); break;
+      case 4: find_canonical_key<4>(); break;
+      case 5: find_canonical_key<5>(); break;
+      case 6: find_canonical_key<6>(); break;
+      case 7: find_canonical_key<7>(); break;
+      case 8: find_canonical_key<8>(); break;
+      default: find_canonical_key<0>(); break;
+    }
+
+    if(do_all) {
+      for(u32 i=0; i<8; i++) {
+        u16 corner_y = image_stones[i][0] >> 16;
+        for(u32 j=0; j<count; j++) {
+          u32 stone = image_stones[i][j];
+          repr_list[i][j] = pack(stone & 0xffff, stone >> 16,
+                                 image_min_x[i], corner_y);
+        }
+      }
+      // Image 2 is image 0 turned half way round, so its corner gives the
+      // far side of image 0.
+      u16 span_x = board_size - image_min_x[2] - image_min_x[0];
+      u16 span_y = board_size - (image_stones[2][0] >> 16) -
+                   (image_stones[0][0] >> 16);
+      for(u32 i=0; i<8; i++) {
+        //TODO: is it faster to do two i loops w/o the if, or is the optimizer
+        //      getting it?
+        if(i<4) {
+          u32_to_buf(
+            packed_repr_buffs[i], repr_list[i], count, span_x, span_y);
+        } else {
+          u32_to_buf(
+            packed_repr_buffs[i], repr_list[i], count, span_y, span_x);
+        }
+      }
+    }
+
+    if(!skip_update) {
+      WalkedBoards * walked_set = walked();
+      std::lock_guard<std::mutex> lock(walked_set->mutex);
+      if(!walked_set->insert(canonical_key)) {
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  // Whether a walk about to place val could still get as far as target.
+  //
+  // Every value from val up needs a square of its own. A square whose
+  // neighbor sum is c right now ends up holding either c (if nothing more is
+  // placed next to it) or at least c + val (if something is, since everything
+  // placed from here on is at least val). A square with no neighbors yet needs
+  // two new ones, so it can't hold anything under 2*val + 1; that's also where
+  // stones with nothing placed around them come in, since their neighbors
+  // already have sums. So below 2*val, the values val..m can only go on
+  // squares with sums of exactly val..m (one value per sum, however many
+  // squares share it) or on squares with sums of 1..m-val.
+  bool can_reach(u16 val, u16 target) {
+    u32 available = 0;
+    for(u32 m=val; m<=target; m++) {
+      if(m >= 2*val) {
+        return true;
+      }
+      if(frontier_counts[m] > 0) {
+        available++;
+      }
+      if(m > val) {
+        available += frontier_counts[m - val];
+      }
+      if(available < m - val + 1) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // A square that maps too close to the edge of the window counts as an
+  // overflow, the same as placing a value there.
+  u32 map_square(u32 symmetry, u32 square) {
+    s32 tx, ty;
+    StoneSymmetries::transform(
+        stabilizer_images[symmetry], x_of(square), y_of(square), tx, ty);
+    tx += stabilizer_shifts[symmetry][0];
+    ty += stabilizer_shifts[symmetry][1];
+    if(!is_inside_window(tx, ty, window_margin)) {
+      window_overflow = true;
+      return square;
+    }
+    return square_at(tx, ty);
+  }
+
+  void find_stabilizer() {
+    WorkUnit stones;
+    get_work_unit(stones);
+    StoneSymmetries symmetries(stones);
+    stabilizer_size = 0;
+    for(u32 i=0; i<8; i++) {
+      // Unlike is_automorphism(), these map the stones onto themselves as
+      // they sit, not onto their canonical image.
+      if(symmetries.keys[i] == symmetries.keys[0]) {
+        stabilizer_images[stabilizer_size] = i;
+        stabilizer_shifts[stabilizer_size][0] =
+            symmetries.corner_x[0] - symmetries.corner_x[i];
+        stabilizer_shifts[stabilizer_size][1] =
+            symmetries.corner_y[0] - symmetries.corner_y[i];
+        stabilizer_size++;
+      }
+    }
+    walk_symmetries = (1 << stabilizer_size) - 1;
+  }
+
+  // True if no symmetry in the mask maps the square to one earlier in the
+  // board (y first, then x).
+  bool is_walk_representative(u32 square, u32 symmetries) {
+    for(u32 i=1; i<stabilizer_size; i++) {
+      if((symmetries & (1 << i)) && map_square(i, square) < square) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // The symmetries in the mask that leave the square where it is.
+  u32 symmetries_fixing(u32 square, u32 symmetries) {
+    u32 fixing = 1;
+    for(u32 i=1; i<stabilizer_size; i++) {
+      if((symmetries & (1 << i)) && map_square(i, square) == square) {
+        fixing |= 1 << i;
+      }
+    }
+    return fixing;
+  }
+
+  // The walk only visits one of each set of symmetric squares, but _expand()
+  // needs all of the squares a full walk would have, so fill in the rest.
+  void add_symmetric_visits() {
+    symmetric_visits.clear();
+    ITERATE(visited, square) {
+      symmetric_visits.push_back(square);
+    }
+    for(u32 square : symmetric_visits) {
+      for(u32 i=1; i<stabilizer_size; i++) {
+        visited_insert(visited_list, map_square(i, square));
+      }
+    }
+  }
+
+  // The part of _walk() before it goes through the candidates for val: counts
+  // the node and records the score. Returns false if there's nothing to go
+  // through, whether there are no candidates or the node was pruned.
+  bool walk_enter(u16 val) {
+    walk_nodes++;
+    if(window_overflow) {
+      return false; // It all gets thrown out anyway.
+    }
+    if(buckets[val].empty()) {
+      return false;
+    }
+    walk_score = std::max(walk_score, val);
+    if(val > best_scores[one_point_count]) {
+      best_scores[one_point_count] = val;
+      std::lock_guard<std::mutex> lock(stdout_mutex);
+      printf("New best (%d stones): %d\n", one_point_count, val);
+      print(true, false, false);
+      best_solutions[one_point_count] = canonical_repr();
+      printf("\n");
+    }
+    if(pruning && !can_reach(
+        val, std::max(best_scores[one_point_count], target_score))) {
+      pruned_nodes++;
+      return false;
+    }
+    return true;
+  }
+
+  // False if square needn't be tried, given the symmetries left when its
+  // level started. Otherwise narrows walk_symmetries to those left once it's
+  // placed.
+  bool narrow_walk_symmetries(u32 square, u32 symmetries) {
+    if(symmetries != 1) {
+      // The values placed so far are symmetric, so this square's walk
+      // would be a mirror image of the one from its representative.
+      if(!is_walk_representative(square, symmetries)) {
+        return false;
+      }
+      walk_symmetries = symmetries_fixing(square, symmetries);
+    }
+    return true;
+  }
+
+  void _walk(u16 val) {
+    if(!walk_enter(val)) {
+      return;
+    }
+    // No copy: see buckets. Squares that land in the bucket while a square in
+    // it is being tried go on the end, past candidate_count, and are gone
+    // again by the time the next one is read.
+    std::vector<u32> & bucket = buckets[val];
+    u32 candidate_count = bucket.size();
+    u32 symmetries = walk_symmetries;
+    for(u32 i=0; i<candidate_count; i++) {
+      u32 square = bucket[i];
+      if(!narrow_walk_symmetries(square, symmetries)) {
+        continue;
+      }
+      _push(square, val);
+      frontier_counts[val]--;
+      _walk(val+1);
+      frontier_counts[val]++;
+      _pop(square);
+    }
+    walk_symmetries = symmetries;
+  }
+
+  void start_walk_frame(u16 val, u16 first_val) {
+    WalkFrame & frame = walk_frames[val];
+    frame.next = 0;
+    frame.candidate_count = buckets[val].size();
+    frame.symmetries = walk_symmetries;
+    if(donating && val - first_val < donatable_levels) {
+      walk_snapshots[val] = buckets[val];
+    }
+  }
+
+  // Hands the candidates not yet tried at the shallowest donatable level that
+  // has any over to walk_queue, as a WalkUnit.
+  void donate_walk(u16 first_val, u16 val) {
+    if(window_shift < max_window_shift) {
+      // An overflow reruns the walk from the start, which would walk whatever
+      // was given away a second time. So stop and start over on the largest
+      // window first; overflowing that one is fatal, so there's no rerun.
+      window_overflow = true;
+      donation_needs_room = true;
+      return;
+    }
+    u16 last_level = std::min<u16>(val, first_val + donatable_levels - 1);
+    for(u16 level=first_val; level<=last_level; level++) {
+      WalkFrame & frame = walk_frames[level];
+      if(frame.next == frame.candidate_count) {
+        continue;
+      }
+      WalkUnit unit;
+      get_work_unit(unit.board);
+      for(u16 v=2; v<level; v++) {
+        u32 square = walk_frames[v].square;
+        unit.prefix.push_back((y_of(square) << 16) + x_of(square));
+      }
+      for(u32 i=frame.next; i<frame.candidate_count; i++) {
+        u32 square = walk_snapshots[level][i];
+        unit.candidates.push_back((y_of(square) << 16) + x_of(square));
+      }
+      frame.candidate_count = frame.next;
+      unit.donor_running = donation_counter;
+      (*donation_counter)++;
+      walk_queue->push(unit);
+      donated_walks++;
+      return;
+    }
+  }
+
+  // _walk() with its recursion replaced by walk_frames. It visits the same
+  // nodes in the same order, but a call per node becomes a trip around the
+  // loop, and the whole state of the walk sits in walk_frames where it can be
+  // looked at.
+  void _walk_iterative(u16 first_val) {
+    if(!walk_enter(first_val)) {
+      return;
+    }
+    start_walk_frame(first_val, first_val);
+    u16 val = first_val;
+    while(true) {
+      WalkFrame & frame = walk_frames[val];
+      if(frame.next < frame.candidate_count) {
+        u32 square = buckets[val][frame.next++];
+        if(!narrow_walk_symmetries(square, frame.symmetries)) {
+          continue;
+        }
+        _push(square, val);
+        frontier_counts[val]--;
+        if(walk_enter(val+1)) {
+          frame.square = square;
+          val++;
+          start_walk_frame(val, first_val);
+          if(donating && (walk_nodes & 0x3ff) == 0 && walk_queue->wanted()) {
+            donate_walk(first_val, val);
+          }
+        } else {
+          frontier_counts[val]++;
+          _pop(square);
+        }
+        continue;
+      }
+
+      // Done with this level: return to the one that placed val-1.
+      walk_symmetries = frame.symmetries;
+      if(val == first_val) {
+        return;
+      }
+      val--;
+      frontier_counts[val]++;
+      _pop(walk_frames[val].square);
+    }
+  }
+
+  void refresh_visited_list() {
+    while(visited_next[visited_list] != visited_end) {
+      visited_erase(visited_next[visited_list]);
+    }
+
+    /*
+    if(visited_next[visited_list] != visited_end) {
+      printf("Fatal %d\n", __LINE__); exit(1);
+    }
+    if(visited_prev[visited_end] != visited_list) {
+      printf("Fatal %d\n", __LINE__); exit(1);
+    }
+    if(visited_prev[visited_list] != no_link) {
+      printf("Fatal %d\n", __LINE__); exit(1);
+    }
+    if(visited_next[visited_end] != no_link) {
+      printf("Fatal %d\n", __LINE__); exit(1);
+    }
+    */
+
+    ITERATE(one_point_squares, square) {
+      for(s16 dy=-1; dy<=1; dy++) {
+        for(s16 dx=-1; dx<=1; dx++) {
+          u16 x = x_of(square) + dx;
+          u16 y = y_of(square) + dy;
+          //printf("adding <%d, %d> back to visited list\n", dx, dy);
+          visited_insert(visited_list, square_at(x, y));
+        }
+      }
+    }
+  }
+
+  void get_hours_minutes_seconds(double time,
+                                 u32 & hours, u32 & minutes, u32 & seconds) {
+    u32 s = time;
+    seconds = s % 60;
+    s /= 60;
+    minutes = s % 60;
+    s /= 60;
+    hours = s;
+  }
+
+public:
+  void report_walk_nodes() {
+    printf("walk nodes: %lu, pruned: %lu\n", walk_nodes, pruned_nodes);
+  }
+
+  // Walks the board as loaded reps times with each engine, and prints how
+  // long each took. Exits with an error if they don't agree on the score and
+  // the nodes walked.
+  void bench_walk(u32 reps) {
+    // One walk first so that the window has grown and the best score is known
+    // before any timing starts, so that every rep after it walks the same
+    // nodes.
+    walk(true);
+
+    // Each engine, with the neighbor sums updated one at a time and then
+    // (if the CPU has AVX2) all at once, whatever simd_neighbors says.
+    bool was_simd = simd_neighbors;
+    u16 scores[4];
+    u64 nodes[4];
+    u32 runs = simd_available() ? 4 : 2;
+    for(u32 run=0; run<runs; run++) {
+      recursive = run % 2 == 0;
+      simd_neighbors = run >= 2;
+      walk_nodes = 0;
+      pruned_nodes = 0;
+      double start = now();
+      for(u32 i=0; i<reps; i++) {
+        scores[run] = walk(true);
+      }
+      double elapsed = now() - start;
+      nodes[run] = walk_nodes / reps;
+      printf("%-10s %-7s score %d, %lu nodes (%lu pruned) per walk, %.3fs, "
+             "%.1f ns/node, %.2fM nodes/s\n",
+             recursive ? "recursive," : "iterative,",
+             simd_neighbors ? "avx2:" : "scalar:", scores[run], nodes[run],
+             pruned_nodes / reps, elapsed, elapsed * 1e9 / walk_nodes,
+             walk_nodes / elapsed / 1e6);
+      if(scores[run] != scores[0] || nodes[run] != nodes[0]) {
+        fprintf(stderr, "The engines disagree\n");
+        exit(1);
+      }
+    }
+    simd_neighbors = was_simd;
+  }
+
+  // Times the two things image_keys does for the board as it stands: the 8
+  // keys of check_and_update_walked_set(), and a StoneSymmetries (which sorts
+  // its images), with and without AVX2.
+  void bench_keys(u32 reps) {
+    WorkUnit stones;
+    get_work_unit(stones);
+    bool was_using_simd = using_simd();
+    u128 keys[2];
+    u128 symmetry_keys[2];
+    for(u32 simd=0; simd<2; simd++) {
+      if(simd && !simd_available()) {
+        printf("avx2:      not available on this CPU\n");
+        break;
+      }
+      use_simd(simd);
+      check_and_update_walked_set(false, true);
+      keys[simd] = canonical_key;
+      symmetry_keys[simd] = StoneSymmetries(stones).canonical_key;
+      // Checked every time, so that the calls can't be optimized away.
+      bool changed = false;
+      double start = now();
+      for(u32 i=0; i<reps; i++) {
+        check_and_update_walked_set(false, true);
+        changed |= canonical_key != keys[simd];
+      }
+      double key_time = now() - start;
+
+      start = now();
+      for(u32 i=0; i<reps; i++) {
+        StoneSymmetries symmetries(stones);
+        changed |= symmetries.canonical_key != symmetry_keys[simd];
+      }
+      double symmetry_time = now() - start;
+
+      printf("%-10s board keys %.1f ns, symmetries %.1f ns\n",
+             simd ? "avx2:" : "scalar:", key_time * 1e9 / reps,
+             symmetry_time * 1e9 / reps);
+      if(changed) {
+        fprintf(stderr, "The keys changed between reps\n");
+        exit(1);
+      }
+    }
+    if(simd_available() &&
+       (keys[0] != keys[1] || symmetry_keys[0] != symmetry_keys[1])) {
+      fprintf(stderr, "The scalar and AVX2 keys disagree\n");
+      exit(1);
+    }
+    use_simd(was_using_simd);
+  }
+
+  void report_counts(bool force=true) {
+    if(!force) {
+      return;
+    }
+    printf("\n");
+    for(u32 i=2; i<=max_depth; i++) {
+      printf("%d stone best: %d, checked: %lu/%lu, solution: %s\n",
+          i, best_scores[i], checked_board_counts[i], total_board_counts[i],
+          best_solutions[i].c_str());
+    }
+    if(prune) {
+      report_walk_nodes();
+    }
+    if(donated_walks > 0) {
+      printf("walks given to idle threads: %lu\n", donated_walks);
+    }
+    if(walked_boards != NULL) {
+      // Other threads may be using it, and it's shared with them.
+      std::lock_guard<std::mutex> lock(walked_boards->mutex);
+      walked_boards->report();
+    }
+#ifdef COUNT_MALLOCS
+    // Process-wide, so with -j this includes every thread.
+    u64 mallocs = malloc_count();
+    printf("mallocs: %lu (%lu since the last report)\n",
+           mallocs, mallocs - reported_mallocs);
+    reported_mallocs = mallocs;
+#endif
+
+    u32 compute_on = (u16)5 < max_depth ? 5 : max_depth;
+    //Throws an inexplicable linker error on max_depth:
+    //u32 compute_on = std::min((u16)5, max_depth); // 5 is the best we have counts for.
+    double fraction_completed =
+        (double)checked_board_counts[compute_on]/total_board_counts[compute_on];
+    double elapsed_time = now() - start_time;
+    u32 elapsed_hours;
+    u32 elapsed_mins;
+    u32 elapsed_secs;
+    get_hours_minutes_seconds(
+        elapsed_time, elapsed_hours, elapsed_mins, elapsed_secs);
+    double eta = elapsed_time/fraction_completed - elapsed_time;
+    u32 eta_hours;
+    u32 eta_mins;
+    u32 eta_secs;
+    get_hours_minutes_seconds(eta, eta_hours, eta_mins, eta_secs);
+    printf("[%6.4f%%] in %dh%02dm%02ds. Eta: %dh%02dm%02ds\n",
+           fraction_completed*100.0, elapsed_hours, elapsed_mins, elapsed_secs,
+           eta_hours, eta_mins, eta_secs);
+    printf("fract:%0.6f t:%6.4f eta:%6.4f\n",
+           fraction_completed, elapsed_time, eta);
+    fflush(stdout);
+  }
+
+  Board(u16 max_depth_requested) :
+      own_walked_boards(NULL),
+      walked_boards(NULL),
+      max_depth(max_depth_requested),
+      one_point_count(0),
+      walk_queue(NULL),
+      donating(false),
+      donated_walks(0),
+      own_donations(0),
+      donation_counter(&own_donations),
+      recursive(false),
+      work_queue(NULL),
+      split_depth(0),
+      verbose(true),
+      orderly(false),
+      prune(false),
+      pruning(false),
+      target_score(0),
+      walk_nodes(0),
+      pruned_nodes(0),
+      leaf_queue(NULL),
+      leaf_dedup(NULL)
+  {
+    start_time = now();
+#ifdef COUNT_MALLOCS
+    reported_mallocs = malloc_count();
+#endif
+    build_window(first_window_shift);
+    std::fill(best_scores, best_scores + max_depth_computable + 1, 0);
+    std::fill(checked_board_counts,
+              checked_board_counts + max_depth_computable + 1, 0);
+    best_solutions.resize(max_depth_computable+1);
   }
 
   Board(u16 max_depth_requested, const std::string & state) :
       Board(max_depth_requested)
   {
+    load(state);
+  }
+
+  ~Board() {
+    delete own_walked_boards;
+  }
+
+  Board(u16 max_depth_requested, const char * state) :
+      Board(max_depth_requested, std::string(state))
+  {
+  }
+
+  // The packed board string of the board as it sits.
+  std::string repr() {
+    check_and_update_walked_set(true, true);
+    return std::string(packed_repr_buffs[0]);
+  }
+
+  // The string of the symmetry with the canonical key. Unlike
+  // packed_repr_buffs[0], this doesn't depend on which reflection of the board
+  // we happened to reach first, so it gives the same answer no matter what
+  // order boards are visited in.
+  std::string canonical_repr() {
+    check_and_update_walked_set(true, true);
+    return std::string(packed_repr_buffs[canonical_image]);
+  }
+
+  u16 stone_count() {
+    return one_point_count;
+  }
+
+  // Returns the highest value placed on this board. With may_prune (and
+  // prune set), a board that can't reach the best score may come back with
+  // less than its real score. _all() only allows that at max_depth, since the
+  // squares a walk visits decide which boards come next.
+  u16 walk(bool may_prune=false) {
+    pruning = prune && may_prune;
+    // Giving part of the walk away is fine for the same boards as pruning,
+    // the ones whose visited squares don't matter.
+    donating = walk_queue != NULL && may_prune && !recursive;
+    u64 start_walk_nodes = walk_nodes;
+    u64 start_pruned_nodes = pruned_nodes;
+    while(true) {
+      walk_score = 1;
+      find_stabilizer();
+      if(recursive) {
+        _walk(2);
+      } else {
+        _walk_iterative(2);
+      }
+      if(stabilizer_size > 1 && !window_overflow) {
+        add_symmetric_visits();
+      }
+      if(!window_overflow) {
+        break;
+      }
+      // Anything this walk found was a real placement, just not necessarily
+      // the best, so only the node counts need undoing.
+      walk_nodes = start_walk_nodes;
+      pruned_nodes = start_pruned_nodes;
+      grow_window_for_rerun();
+      refresh_visited_list();
+    }
+    pruning = false;
+    donating = false;
+    settle_tie();
+    return walk_score;
+  }
+
+  // Ties go to the smallest canonical repr, so the reported solutions don't
+  // depend on the order boards were walked in (see BoardPool).
+  void settle_tie() {
+    if(walk_score > 1 && walk_score == best_scores[one_point_count]) {
+      check_and_update_walked_set(true, true);
+      const char * repr = packed_repr_buffs[canonical_image];
+      if(best_solutions[one_point_count].compare(repr) > 0) {
+        best_solutions[one_point_count] = repr;
+      }
+    }
+  }
+
+  // Places the prefix of a WalkUnit, as the walk that gave it away had it,
+  // then walks each of its candidates, then takes it all back off.
+  void _walk_unit(const WalkUnit & unit) {
+    u16 val = 2;
+    for(u32 position : unit.prefix) {
+      u32 square = square_at(position & 0xffff, position >> 16);
+      WalkFrame & frame = walk_frames[val];
+      frame.next = frame.candidate_count = 0;
+      frame.symmetries = walk_symmetries;
+      frame.square = square;
+      narrow_walk_symmetries(square, frame.symmetries);
+      _push(square, val);
+      frontier_counts[val]--;
+      val++;
+    }
+
+    WalkFrame & frame = walk_frames[val];
+    frame.next = frame.candidate_count = 0;
+    frame.symmetries = walk_symmetries;
+    for(u32 position : unit.candidates) {
+      u32 square = square_at(position & 0xffff, position >> 16);
+      if(!narrow_walk_symmetries(square, frame.symmetries)) {
+        continue;
+      }
+      frame.square = square;
+      _push(square, val);
+      frontier_counts[val]--;
+      _walk_iterative(val+1);
+      frontier_counts[val]++;
+      _pop(square);
+    }
+    walk_symmetries = frame.symmetries;
+
+    while(val > 2) {
+      val--;
+      frontier_counts[val]++;
+      _pop(walk_frames[val].square);
+      walk_symmetries = walk_frames[val].symmetries;
+    }
+  }
+
+  // The WalkUnit counterpart of walk() on a max_depth board. Its score only
+  // goes towards best_scores: the Board that gave it away has already counted
+  // the board as checked.
+  void run_walk_unit(const WalkUnit & unit) {
+    donation_counter = unit.donor_running;
+    load_work_unit(unit.board);
+    // The squares have to be inside the window before they can be placed.
+    for(u32 position : unit.prefix) {
+      while(!is_inside_window(position & 0xffff, position >> 16, 3)) {
+        grow_window();
+      }
+    }
+    for(u32 position : unit.candidates) {
+      while(!is_inside_window(position & 0xffff, position >> 16, 3)) {
+        grow_window();
+      }
+    }
+    pruning = prune;
+    donating = walk_queue != NULL;
+    u64 start_walk_nodes = walk_nodes;
+    u64 start_pruned_nodes = pruned_nodes;
+    while(true) {
+      walk_score = 1;
+      find_stabilizer();
+      _walk_unit(unit);
+      if(!window_overflow) {
+        break;
+      }
+      walk_nodes = start_walk_nodes;
+      pruned_nodes = start_pruned_nodes;
+      grow_window_for_rerun();
+    }
+    pruning = false;
+    donating = false;
+    settle_tie();
+  }
+
+  void all() {
+    enumerate();
+    report_counts(true);
+  }
+
+  // Runs _all() from each of the 2-stone starting boards.
+  void enumerate() {
+    push(board_mid, board_mid);
+    for(u16 dy=0; dy<=2; dy++) {
+      for(u16 dx=0; dx<=2; dx++) {
+        // Orderly mode has no walked_boards to weed out the reflections, so
+        // start from just the 5 distinct 2-stone boards.
+        if((dx || dy) && (!orderly || dx >= dy)) {
+          push(board_mid + dx, board_mid + dy);
+          search(2);
+          pop(board_mid + dx, board_mid + dy);
+        }
+      }
+    }
+  }
+
+  //TODO: move to private:
+  // Fills expanded with (y << 16) + x, rather than square indices, since the
+  // window can grow while the children are being pushed. They come out sorted
+  // and without repeats, the same as from a std::set.
+  void _expand(std::vector<u32> & expanded) {
+    expanded.clear();
+    ITERATE(visited, square) {
+      for(s16 dy=-2; dy<=2; dy++) {
+        for(s16 dx=-2; dx<=2; dx++) {
+          expanded.push_back(((y_of(square) + dy) << 16) + x_of(square) + dx);
+        }
+      }
+    }
+    std::sort(expanded.begin(), expanded.end());
+    expanded.erase(std::unique(expanded.begin(), expanded.end()),
+                   expanded.end());
+  }
+
+  /*
+  Orderly mode (-o) generates each board exactly once, up to symmetry, with
+  no walked_boards at all. It's McKay's canonical augmentation. A board C
+  with n stones is only expanded from one parent: C minus its "canonical
+  deletion", the first stone t, in the order the stones appear in C's
+  canonical image, such that C - t is itself one of the boards _all() visits
+  and t is one of the squares _all() tries on it. _all() on a parent P then
+  keeps a child P + s only if s is (a symmetry of) the canonical deletion of
+  P + s, and only tries one square from each set of squares that P's own
+  symmetries map onto each other.
+
+  "One of the boards _all() visits" is a closure: the 2-stone boards at
+  distance 2 or less, plus anything reachable from them by adding a stone
+  within 2 squares of the parent's visited list. Two shortcuts keep that
+  from needing a walk most of the time:
+    * Every visited list contains the 3x3 around each stone, so any square
+      within 3 of a stone gets tried.
+    * A board needs two stones within 2 of each other (nothing else has a
+      square worth 2 to walk). If it has that, and its stones are connected
+      by hops of 3 or less, it's in.
+  Only a stone more than 3 from all the others needs a walk of the board
+  without it, to see whether that walk's visited list reached it.
+  */
+
+  // True if no symmetry of the parent board maps (x, y) to a square that
+  // comes earlier.
+  bool is_orbit_representative(StoneSymmetries & parent, u16 x, u16 y) {
+    s64 offset = parent.offset(parent.canonical_image, x, y);
+    for(u32 i=0; i<8; i++) {
+      if(parent.is_automorphism(i) && parent.offset(i, x, y) < offset) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  static u16 distance(const WorkUnit & stones, u32 a, u32 b) {
+    s32 dx = abs((s32)stones.stones[a][0] - stones.stones[b][0]);
+    s32 dy = abs((s32)stones.stones[a][1] - stones.stones[b][1]);
+    return std::max(dx, dy);
+  }
+
+  static void remove_stone(const WorkUnit & stones, u32 index, WorkUnit & rest) {
+    rest.stone_count = 0;
+    for(u32 i=0; i<stones.stone_count; i++) {
+      if(i != index) {
+        rest.stones[rest.stone_count][0] = stones.stones[i][0];
+        rest.stones[rest.stone_count][1] = stones.stones[i][1];
+        rest.stone_count++;
+      }
+    }
+  }
+
+  // True if these stones pass the shortcut test above. Anything that passes
+  // is reachable; anything that fails may or may not be.
+  bool is_plainly_reachable(const WorkUnit & stones) {
+    u32 count = stones.stone_count;
+    if(count == 2) {
+      return distance(stones, 0, 1) <= 2;
+    }
+
+    bool has_close_pair = false;
+    for(u32 i=0; i<count; i++) {
+      for(u32 j=i+1; j<count; j++) {
+        has_close_pair |= distance(stones, i, j) <= 2;
+      }
+    }
+    if(!has_close_pair) {
+      return false;
+    }
+
+    // Flood fill over hops of 3 or less.
+    bool connected[max_depth_computable] = {true};
+    u32 connected_count = 1;
+    for(bool grew = true; grew; ) {
+      grew = false;
+      for(u32 i=0; i<count; i++) {
+        for(u32 j=0; j<count && !connected[i]; j++) {
+          if(connected[j] && distance(stones, i, j) <= 3) {
+            connected[i] = grew = true;
+            connected_count++;
+          }
+        }
+      }
+    }
+    return connected_count == count;
+  }
+
+  // True if _all() would visit a board with these stones.
+  bool is_reachable(const WorkUnit & stones) {
+    if(is_plainly_reachable(stones)) {
+      return true;
+    }
+    if(stones.stone_count == 2) {
+      return false;
+    }
+    for(u32 i=0; i<stones.stone_count; i++) {
+      if(is_valid_deletion(stones, i)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  bool is_near_another(const WorkUnit & stones, u32 index) {
+    for(u32 i=0; i<stones.stone_count; i++) {
+      if(i != index && distance(stones, i, index) <= 3) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // True if stones minus stones[index] is reachable, and _all() on it would
+  // try stones[index].
+  bool is_valid_deletion(const WorkUnit & stones, u32 index) {
+    WorkUnit rest;
+    remove_stone(stones, index, rest);
+    if(!is_reachable(rest)) {
+      return false;
+    }
+    if(is_near_another(stones, index)) {
+      return true;
+    }
+    return walk_reaches(rest, stones.stones[index][0], stones.stones[index][1]);
+  }
+
+  // Walks a board with just these stones and reports whether (x, y) ends up
+  // within 2 of its visited list, i.e. whether _expand() would offer it. The
+  // Board's own stones are put back afterwards.
+  bool walk_reaches(const WorkUnit & stones, u16 x, u16 y) {
+    WorkUnit saved;
+    get_work_unit(saved);
+    load_work_unit(stones);
+
+    refresh_visited_list();
+    walk();
+    bool reached = false;
+    ITERATE(visited, square) {
+      if(abs((s32)x_of(square) - x) <= 2 && abs((s32)y_of(square) - y) <= 2) {
+        reached = true;
+        break;
+      }
+    }
+
+    load_work_unit(saved);
+    return reached;
+  }
+
+  // The board holds a parent plus a new stone at (x, y). True if (x, y) is, up
+  // to symmetry, the board's canonical deletion.
+  //
+  // Any order of the stones works for picking the canonical deletion, so long
+  // as it only depends on the shape of the board. Stones are tried in three
+  // tiers, each in canonical image order, so walks are rarely needed:
+  //   0. Near another stone, and the rest is plainly reachable. Always valid.
+  //   1. Far from the others, and the rest is plainly reachable. Needs a walk.
+  //   2. Everything else.
+  bool is_canonical_child(u16 x, u16 y) {
+    WorkUnit child;
+    get_work_unit(child);
+    StoneSymmetries symmetries(child);
+    u32 count = child.stone_count;
+    u32 canonical = symmetries.canonical_image;
+
+    u32 added;
+    for(added=0; added<count; added++) {
+      if(child.stones[added][0] == x && child.stones[added][1] == y) {
+        break;
+      }
+    }
+
+    u32 order[max_depth_computable];
+    u32 tier[max_depth_computable];
+    for(u32 i=0; i<count; i++) {
+      WorkUnit rest;
+      remove_stone(child, i, rest);
+      order[i] = i;
+      tier[i] = is_plainly_reachable(rest) ? (is_near_another(child, i) ? 0 : 1)
+                                           : 2;
+    }
+    std::sort(order, order + count, [&](u32 a, u32 b) {
+      if(tier[a] != tier[b]) {
+        return tier[a] < tier[b];
+      }
+      return symmetries.packed[canonical][a] < symmetries.packed[canonical][b];
+    });
+
+    for(u32 i=0; i<count; i++) {
+      u32 candidate = order[i];
+      // Some symmetry of the board takes the added stone to this one. Removing
+      // it leaves (a symmetry of) the parent, which is known to be valid.
+      for(u32 image=0; image<8; image++) {
+        if(symmetries.is_automorphism(image) &&
+           symmetries.packed[image][added] ==
+           symmetries.packed[canonical][candidate]) {
+          return true;
+        }
+      }
+      if(tier[candidate] == 0 || is_valid_deletion(child, candidate)) {
+        return false;
+      }
+    }
+    return true; // Not reached: the added stone is always in the order.
+  }
+
+  //TODO: move to private:
+  // The part of _all() before it goes through the children: walks the board,
+  // if it hasn't been already. Returns false if there are no children to go
+  // through.
+  bool all_enter(u32 depth) {
+    if(depth == max_depth && leaf_dedup != NULL) {
+      check_and_update_walked_set(false, true);
+      leaf_dedup->submit(canonical_key, repr());
+      return false;
+    }
+    if(!orderly && check_and_update_walked_set()) {
+      return false;
+    }
+    if(depth == max_depth && leaf_queue != NULL) {
+      // An Orchestrator's board: a client walks this one.
+      leaf_queue->push(repr());
+      return false;
+    }
+    if(depth < max_depth) {
+      //The visited list won't be used for depth < max depth, so don't
+      //go through the overhead of clearing it.
+      refresh_visited_list();
+    }
+    walk(depth == max_depth);
+    checked_board_counts[depth]++;
+    if(depth >= max_depth) {
+      return false;
+    }
+    report_counts(verbose);
+    return true;
+  }
+
+  // True if the child made by pushing (x, y) is one to look at, rather than
+  // one that's already been or will be looked at from elsewhere.
+  bool is_child_to_try(StoneSymmetries & parent_symmetries, u16 x, u16 y) {
+    if(square_val[square_at(x, y)] != 0) {
+      return false;
+    }
+    return !orderly || is_orbit_representative(parent_symmetries, x, y);
+  }
+
+  // Call with (x, y) pushed. False if the child isn't for this Board to look
+  // at further: it's a duplicate, or it went on work_queue.
+  bool keep_child(u32 depth, u16 x, u16 y) {
+    if(orderly && !is_canonical_child(x, y)) {
+      return false;
+    }
+    if(work_queue != NULL && depth + 1 <= split_depth) {
+      WorkUnit unit;
+      get_work_unit(unit);
+      work_queue->push(unit);
+      return false;
+    }
+    return true;
+  }
+
+  void _all(u32 depth) {
+    if(!all_enter(depth)) {
+      return;
+    }
+    WorkUnit parent;
+    get_work_unit(parent);
+    StoneSymmetries parent_symmetries(parent);
+
+    std::vector<u32> & expanded = expand_candidates[depth];
+    _expand(expanded);
+    for(u32 position : expanded) {
+      u16 x = position & 0xffff;
+      u16 y = position >> 16;
+      if(!is_child_to_try(parent_symmetries, x, y)) {
+        continue;
+      }
+      push(x, y);
+      if(keep_child(depth, x, y)) {
+        _all(depth + 1);
+      }
+      pop(x, y);
+    }
+  }
+
+  void start_all_frame(u32 depth) {
+    AllFrame & frame = all_frames[depth];
+    WorkUnit parent;
+    get_work_unit(parent);
+    frame.parent_symmetries = StoneSymmetries(parent);
+    frame.next = 0;
+    _expand(expand_candidates[depth]);
+  }
+
+  // _all() with its recursion replaced by all_frames, in the same way as
+  // _walk_iterative().
+  void _all_iterative(u32 first_depth) {
+    if(!all_enter(first_depth)) {
+      return;
+    }
+    start_all_frame(first_depth);
+    u32 depth = first_depth;
+    while(true) {
+      AllFrame & frame = all_frames[depth];
+      std::vector<u32> & expanded = expand_candidates[depth];
+      if(frame.next < expanded.size()) {
+        u32 position = expanded[frame.next++];
+        u16 x = position & 0xffff;
+        u16 y = position >> 16;
+        if(!is_child_to_try(frame.parent_symmetries, x, y)) {
+          continue;
+        }
+        push(x, y);
+        if(keep_child(depth, x, y) && all_enter(depth + 1)) {
+          frame.x = x;
+          frame.y = y;
+          depth++;
+          start_all_frame(depth);
+        } else {
+          pop(x, y);
+        }
+        continue;
+      }
+
+      if(depth == first_depth) {
+        return;
+      }
+      depth--;
+      pop(all_frames[depth].x, all_frames[depth].y);
+    }
+  }
+
+  // Goes through every board reachable from this one, with whichever engine
+  // was asked for.
+  void search(u32 depth) {
+    if(recursive) {
+      _all(depth);
+    } else {
+      _all_iterative(depth);
+    }
+  }
+
+  void push(u16 x, u16 y) {
+    while(!is_inside_window(x, y, stone_margin)) {
+      grow_window();
+    }
+    u32 square = square_at(x, y);
+    one_point_squares_insert(one_point_squares_list, square);
+    add_image_stones(x, y);
+    one_point_count++;
+
+    if(square_neighbor_sum[square] > 0) {
+      bucket_erase(square_neighbor_sum[square], square);
+      frontier_counts[square_neighbor_sum[square]]--;
+    }
+    square_neighbor_sum[square] = 0;
+
+    _push(square, 1);
+  }
+
+  void pop(u16 x, u16 y) {
+    u32 square = square_at(x, y);
+    one_point_squares_erase(square);
+    remove_image_stones(x, y);
+    one_point_count--;
+
+    // Not _pop(): the stones don't necessarily come off in the order they
+    // went on, so the buckets can't be put back slot for slot.
+    square_val[square] = 0;
+    for(u32 i=0; i<8; i++) {
+      u32 neighbor_square = square + neighbor_offsets[i];
+      if(square_val[neighbor_square] == 0) {
+        u16 old_sum = square_neighbor_sum[neighbor_square];
+        u16 new_sum = old_sum - 1;
+        square_neighbor_sum[neighbor_square] = new_sum;
+        bucket_erase(old_sum, neighbor_square);
+        frontier_counts[old_sum]--;
+        if(new_sum > 0) {
+          bucket_insert(new_sum, neighbor_square);
+          frontier_counts[new_sum]++;
+        }
+      }
+    }
+
+    // Only stones are on the board when a stone is popped, so this is just a
+    // count of its neighbors. Recounting, rather than restoring the sum from
+    // when it was pushed, means stones don't have to come off in the order
+    // they went on.
+    u16 sum = 0;
+    for(u32 i=0; i<8; i++) {
+      sum += square_val[square + neighbor_offsets[i]];
+    }
+    square_neighbor_sum[square] = sum;
+    // push() took the square out of its bucket. Put it back, or a later walk
+    // on this Board silently misses it, and the result of a walk would depend
+    // on what the Board had been used for before.
+    if(sum > 0) {
+      bucket_insert(sum, square);
+      frontier_counts[sum]++;
+    }
+  }
+
+  // Pops every stone, most recent first.
+  void clear() {
+    while(one_point_squares_next[one_point_squares_list] !=
+          one_point_squares_end) {
+      u32 square = one_point_squares_next[one_point_squares_list];
+      pop(x_of(square), y_of(square));
+    }
+  }
+
+  // Replaces the stones with those of a packed board string, centered on the
+  // board.
+  void load(const std::string & state) {
+    clear();
     u16 width, height;
     std::vector<std::string> fields = split(state, '|');
+    // A key only has room for so many stones (and so does everything that
+    // builds one).
+    if(fields.size() - 1 > max_key_stones) {
+      fprintf(stderr, "%s has more than %d stones\n", state.c_str(),
+              max_key_stones);
+      exit(1);
+    }
     std::vector<std::string> dimensions = split(fields[0], 'x');
-    width = std::stoi(dimensions[0].c_str(), NULL, 10);
-    height = std::stoi(dimensions[1].c_str(), NULL, 10);
+    // The dimensions are written in hex, like everything else in the string.
+    width = std::stoi(dimensions[0].c_str(), NULL, 16);
+    height = std::stoi(dimensions[1].c_str(), NULL, 16);
     u16 min_x = board_mid - width/2;
     u16 min_y = board_mid - height/2;
     u16 x, y;
@@ -514,157 +2737,1004 @@ public:
     }
   }
 
-  Board(u16 max_depth_requested, const char * state) :
-      Board(max_depth_requested, std::string(state))
-  {
+  void get_work_unit(WorkUnit & unit) {
+    unit.stone_count = one_point_count;
+    // The list is most-recent-first. Store it in push order.
+    u32 i = one_point_count;
+    ITERATE(one_point_squares, square) {
+      i--;
+      unit.stones[i][0] = x_of(square);
+      unit.stones[i][1] = y_of(square);
+    }
+  }
+
+  void load_work_unit(const WorkUnit & unit) {
+    clear();
+    for(u32 i=0; i<unit.stone_count; i++) {
+      push(unit.stones[i][0], unit.stones[i][1]);
+    }
+  }
+
+  void run_work_unit(const WorkUnit & unit) {
+    donation_counter = &own_donations;
+    load_work_unit(unit);
+    search(unit.stone_count);
+  }
+
+  u32 donations_running() {
+    return own_donations;
+  }
+
+  // The string a Checkpoint knows a unit by.
+  std::string unit_repr(const WorkUnit & unit) {
+    load_work_unit(unit);
+    return canonical_repr();
+  }
+
+  void get_checked_counts(u64 * counts) {
+    std::copy(checked_board_counts,
+              checked_board_counts + max_depth_computable + 1, counts);
+  }
+
+  void record_bests(Checkpoint & checkpoint) {
+    checkpoint.record_bests(best_scores, best_solutions);
+  }
+
+  // Starts the counts and bests off from where an earlier run left them.
+  void resume(Checkpoint & checkpoint) {
+    std::string solutions[max_depth_computable + 1];
+    checkpoint.get_results(checked_board_counts, best_scores, solutions);
+    std::copy(solutions, solutions + max_depth_computable + 1,
+              best_solutions.begin());
+  }
+
+  void join_pool(WorkQueue * queue, WalkQueue * shared_walk_queue,
+                 WalkedBoards * shared_walked_boards,
+                 u16 split_depth_requested) {
+    work_queue = queue;
+    walk_queue = shared_walk_queue;
+    walked_boards = shared_walked_boards;
+    split_depth = split_depth_requested;
+    verbose = false;
+  }
+
+  void set_orderly(bool orderly_requested) {
+    orderly = orderly_requested;
+  }
+
+  void set_pruning(bool prune_requested, u16 target_score_requested) {
+    prune = prune_requested;
+    target_score = target_score_requested;
+  }
+
+  void set_recursive(bool recursive_requested) {
+    recursive = recursive_requested;
+  }
+
+  // Keeps the walked boards in files in directory rather than in memory. Not
+  // for a Board in a BoardPool, which uses the pool's.
+  void use_walked_files(const char * directory) {
+    walked()->use_files(directory);
+  }
+
+  void serve_leaves(LeafQueue * queue) {
+    leaf_queue = queue;
+    verbose = false;
+  }
+
+  void use_dedup_shards(DedupShards * shards) {
+    leaf_dedup = shards;
+  }
+
+  // Counts a board at stone_count stones that was walked somewhere else. Not
+  // while this Board is searching; the results would race with its own.
+  // Returns false, and counts nothing, if the result can't be right.
+  bool record_result(u16 stone_count, u16 score, const std::string & solution,
+                     u64 count) {
+    if(stone_count < 2 || stone_count > max_depth ||
+       !is_board_string(solution, stone_count)) {
+      return false;
+    }
+    checked_board_counts[stone_count] += count;
+    if(score > best_scores[stone_count] ||
+       (score == best_scores[stone_count] &&
+        solution < best_solutions[stone_count])) {
+      best_scores[stone_count] = score;
+      best_solutions[stone_count] = solution;
+    }
+    return true;
+  }
+
+  // Folds another Board's results into this one. Ties in score go to the
+  // smaller solution string, the same as in walk().
+  void merge(const Board & other) {
+    donated_walks += other.donated_walks;
+    walk_nodes += other.walk_nodes;
+    pruned_nodes += other.pruned_nodes;
+    for(u32 i=0; i<=max_depth_computable; i++) {
+      checked_board_counts[i] += other.checked_board_counts[i];
+      if(other.best_scores[i] > best_scores[i] ||
+         (other.best_scores[i] == best_scores[i] &&
+          other.best_solutions[i] < best_solutions[i])) {
+        best_scores[i] = other.best_scores[i];
+        best_solutions[i] = other.best_solutions[i];
+      }
+    }
+  }
+
+  void print_square(u32 square) {
+    u16 val = square_val[square];
+    u16 neighbor_sum = square_neighbor_sum[square];
+    if(val == 0) {
+      if(neighbor_sum == 0) {
+        printf("\033[2m");
+      } else {
+        printf("\033[34;1m");
+      }
+    } else {
+      if(val == 1) {
+        printf("\033[31m");
+      }
+    }
+    if(visited_next[square] != no_link) {
+      printf("\033[4m");
+    }
+    printf("%3d,%3d", val, neighbor_sum);
+    if(val <= 1)
+      printf("\033[0m");
+  }
+
+  void print(bool print_first_repr=true, bool print_all_reprs=false,
+             bool print_neighbor_sum_lists=false, bool force=true) {
+    if(!force) {
+      return;
+    }
+
+    u16 min_x_visited, max_x_visited, min_y_visited, max_y_visited;
+    u16 min_x_active = u16_max, max_x_active = u16_min,
+        min_y_active = u16_max, max_y_active = u16_min;
+
+    get_visited_extents(
+        min_x_visited, min_y_visited, max_x_visited, max_y_visited);
+
+    for(u16 y=min_y_visited; y<=max_y_visited; y++) {
+      for(u16 x=min_x_visited; x<=max_x_visited; x++) {
+        if(square_val[square_at(x, y)]) {
+          min_x_active = std::min(min_x_active, x);
+          min_y_active = std::min(min_y_active, y);
+          max_x_active = std::max(max_x_active, x);
+          max_y_active = std::max(max_y_active, y);
+        }
+      }
+    }
+
+    printf("    y\\x|");
+    for(u16 x=min_x_active-1; x<=max_x_active+1; x++) {
+      printf("%7d|", x);
+    }
+    printf("\n");
+    for(u16 y=min_y_active-1; y<=max_y_active+1; y++) {
+      printf("%7d", y);
+      for(u16 x=min_x_active-1; x<=max_x_active+1; x++) {
+        printf("|");
+        print_square(square_at(x, y));
+      }
+      printf("|\n");
+    }
+    if(print_first_repr or print_all_reprs) {
+      check_and_update_walked_set(true, true);
+      if(print_all_reprs) {
+        for(u32 i=0; i<8; i++) {
+          printf("%s\n", packed_repr_buffs[i]);
+        }
+      } else {
+        printf("%s\n", packed_repr_buffs[0]);
+      }
+    }
+    if(print_neighbor_sum_lists) {
+      for(u32 i=0; i<max_neighbor_sums; i++) {
+        if(!buckets[i].empty()) {
+          printf("%d: ", i);
+          for(u32 square : buckets[i]) {
+            printf(" <%d,%d>", x_of(square), y_of(square));
+          }
+          printf(" (%lu squares)\n", buckets[i].size());
+        }
+      }
+    }
+  }
+
+  void print_string_reprs() {
+    check_and_update_walked_set(true, true);
+    for(u32 i=0; i<8; i++) {
+      printf("%d: %s\n", i, packed_repr_buffs[i]);
+    }
+    fflush(stdout);
+  }
+};
+
+// Runs Board::all() across several threads. Each thread has its own Board,
+// and every non-leaf child of _all() (see split_depth) becomes a WorkUnit on
+// that thread's queue. A thread that runs dry steals from the others. The
+// walked boards are shared, so each board is still walked exactly once, and
+// the results are merged into the first Board at the end.
+class BoardPool {
+private:
+  u32 thread_count;
+  bool orderly;
+  std::vector<Board *> boards;
+  WorkQueue * queues;
+  WalkQueue walk_queue;
+  WalkedBoards walked_boards;
+  std::atomic<u64> pending;
+  Checkpoint * checkpoint;
+
+  bool get_work(u32 thread_index, WorkUnit & unit) {
+    if(queues[thread_index].pop(unit)) {
+      return true;
+    }
+    for(u32 i=1; i<thread_count; i++) {
+      if(queues[(thread_index + i) % thread_count].steal(unit)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void work(u32 thread_index) {
+    WorkUnit unit;
+    WalkUnit walk_unit;
+    bool idle = false;
+    while(pending > 0) {
+      if(get_work(thread_index, unit)) {
+        set_idle(idle, false);
+        run_unit(thread_index, unit, idle);
+        pending--;
+      } else if(walk_queue.pop(walk_unit)) {
+        set_idle(idle, false);
+        run_walk_unit(thread_index, walk_unit);
+      } else {
+        // Ask the threads still walking to give some of it away.
+        set_idle(idle, true);
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+      }
+    }
+    set_idle(idle, false);
+  }
+
+  void run_unit(u32 thread_index, const WorkUnit & unit, bool & idle) {
+    Board * board = boards[thread_index];
+    if(checkpoint == NULL || unit.stone_count != checkpoint->unit_depth) {
+      board->run_work_unit(unit);
+      return;
+    }
+
+    std::string repr = board->unit_repr(unit);
+    if(checkpoint->is_completed(repr)) {
+      return;
+    }
+    u64 counts_before[max_depth_computable + 1];
+    board->get_checked_counts(counts_before);
+    board->run_work_unit(unit);
+
+    // The unit isn't finished until the walks it gave away are, so help with
+    // those (or anyone's) in the meantime.
+    WalkUnit walk_unit;
+    while(board->donations_running() > 0) {
+      if(walk_queue.pop(walk_unit)) {
+        set_idle(idle, false);
+        run_walk_unit(thread_index, walk_unit);
+      } else {
+        set_idle(idle, true);
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+      }
+    }
+    set_idle(idle, false);
+
+    u64 counts[max_depth_computable + 1];
+    board->get_checked_counts(counts);
+    for(u32 i=0; i<=max_depth_computable; i++) {
+      counts[i] -= counts_before[i];
+    }
+    board->record_bests(*checkpoint);
+    checkpoint->complete(repr, counts);
+  }
+
+  void run_walk_unit(u32 thread_index, const WalkUnit & walk_unit) {
+    boards[thread_index]->run_walk_unit(walk_unit);
+    if(checkpoint != NULL) {
+      // Before the donor hears it's done, so that its bests are in the
+      // checkpoint by the time the unit is.
+      boards[thread_index]->record_bests(*checkpoint);
+    }
+    (*walk_unit.donor_running)--;
+    pending--;
+  }
+
+  void set_idle(bool & idle, bool now_idle) {
+    if(now_idle != idle) {
+      idle = now_idle;
+      if(idle) {
+        walk_queue.idle++;
+      } else {
+        walk_queue.idle--;
+      }
+    }
+  }
+
+public:
+  BoardPool(u16 max_depth, u32 thread_count_requested, bool orderly_requested,
+            bool prune, u16 target_score, bool recursive,
+            Checkpoint * checkpoint_requested=NULL) :
+      thread_count(thread_count_requested),
+      orderly(orderly_requested),
+      pending(0),
+      checkpoint(checkpoint_requested)
+  {
+    queues = new WorkQueue[thread_count];
+    walk_queue.pending = &pending;
+    // Leaves (boards at max_depth) are cheap and numerous, so they're walked
+    // in place by whoever holds their parent. With a checkpoint, each unit
+    // has to run start to finish on one thread, so splitting stops there.
+    u16 split_depth = max_depth - 1;
+    if(checkpoint != NULL) {
+      split_depth = checkpoint->unit_depth;
+    }
+    for(u32 i=0; i<thread_count; i++) {
+      queues[i].pending = &pending;
+      boards.push_back(new Board(max_depth));
+      boards[i]->join_pool(&queues[i], &walk_queue, &walked_boards,
+                           split_depth);
+      boards[i]->set_orderly(orderly);
+      boards[i]->set_pruning(prune, target_score);
+      boards[i]->set_recursive(recursive);
+    }
+    if(checkpoint != NULL) {
+      boards[0]->resume(*checkpoint);
+    }
+  }
+
+  void use_walked_files(const char * directory) {
+    walked_boards.use_files(directory);
+  }
+
+  ~BoardPool() {
+    for(Board * board : boards) {
+      delete board;
+    }
+    delete [] queues;
+  }
+
+  void all() {
+    // Same starting boards as Board::enumerate(), dealt out round robin.
+    u32 next_queue = 0;
+    for(u16 dy=0; dy<=2; dy++) {
+      for(u16 dx=0; dx<=2; dx++) {
+        if((dx || dy) && (!orderly || dx >= dy)) {
+          WorkUnit unit;
+          unit.stone_count = 2;
+          unit.stones[0][0] = Board::board_mid;
+          unit.stones[0][1] = Board::board_mid;
+          unit.stones[1][0] = Board::board_mid + dx;
+          unit.stones[1][1] = Board::board_mid + dy;
+          queues[next_queue++ % thread_count].push(unit);
+        }
+      }
+    }
+
+    if(checkpoint != NULL) {
+      checkpoint->start();
+    }
+    std::vector<std::thread> threads;
+    for(u32 i=0; i<thread_count; i++) {
+      threads.emplace_back(&BoardPool::work, this, i);
+    }
+    for(std::thread & thread : threads) {
+      thread.join();
+    }
+    if(checkpoint != NULL) {
+      checkpoint->finish();
+    }
+
+    for(u32 i=1; i<thread_count; i++) {
+      boards[0]->merge(*boards[i]);
+    }
+    boards[0]->report_counts(true);
+  }
+};
+
+// The types of the frames in a distributed run (see SocketBase).
+enum MessageType {
+  // Worker to Orchestrator: the results of the boards it's finished since it
+  // last sent any, in the order they were handed out, and how many more
+  // boards it wants (0 to only send results). The payload is a u16 count
+  // wanted and a u16 result count, then for each result a u16 stone count,
+  // u16 score, u64 board count, and the solution's packed board string.
+  results_message = 1,
+  // Orchestrator to Worker: a u16 board count, then that many packed board
+  // strings.
+  boards_message = 2,
+  // Orchestrator to Worker, with no payload: there's nothing left.
+  done_message = 3
+};
+
+// The -s side of a distributed run. The search down to max_depth - 1 runs
+// here: those walks decide which boards come next, and keeping the walked set
+// in one place means every board is counted exactly once. The boards at
+// max_depth are handed to clients in batches, and the clients' scores and
+// counts are folded back into the local Board.
+//
+// Each client keeps one connection open for the whole run. It asks for boards,
+// and gets back as many as are ready (up to the number it asked for), or
+// done_message. A client that asks when no board is ready is held until one
+// is, rather than being told to try again later. Results can come back with
+// the next request or on their own, but always in the order the boards went
+// out, so they retire the connection's oldest outstanding boards.
+//
+// Every board handed out is held under a lease until its result comes back.
+// If its connection closes, or it's out for much longer than boards have been
+// taking, it goes out again to someone else; the slow copy may still come
+// back, and whichever does first is the one that counts.
+class Orchestrator {
+private:
+  class Request {
+  public:
+    u32 connection;
+    u16 wanted;
+  };
+
+  // A board that's gone out and not come back yet. It can be out to more
+  // than one connection at once, if it was reissued or duplicated; the first
+  // copy to come back counts, and the rest are dropped.
+  class Lease {
+  public:
+    std::string unit;
+    std::vector<u32> owners; // The connections with a copy out.
+    double issued; // When the latest copy went out.
+    // How long a board's been taking to come back, when that copy went out.
+    // Zero until anything has.
+    double expected;
+    bool queued; // In reissue, waiting to go out again.
+  };
+
+  // One copy of a lease, as held by a connection.
+  class Held {
+  public:
+    u64 lease;
+    double issued;
+  };
+
+  // A lease is reissued after lease_factor times its expected cost, or
+  // min_lease seconds, whichever is longer. Near the end of the run, a lease
+  // that's been out longer than expected is a straggler, and gets a second
+  // copy as soon as a connection has nothing else to do.
+  static constexpr double lease_factor = 4;
+  static constexpr double expiry_check_every = 0.1;
+
+  Server server;
+  u16 max_depth;
+  Board * board;
+  LeafQueue leaves;
+  DedupShards * dedup;
+  // The clients' results. The search thread is busy with board's the whole
+  // time, so these are only folded into it once the search is done.
+  u64 remote_count;
+  u16 remote_best;
+  std::string remote_solution;
+  double min_lease;
+  bool exhausted;
+
+  std::unordered_map<u64, Lease> leases;
+  u64 next_lease;
+  // The leases each connection has yet to return, oldest first.
+  std::unordered_map<u32, std::deque<Held>> outstanding;
+  // Leases whose only copies were lost with their connections, or have
+  // expired. These go out again before anything new. Leases that came back
+  // in the meantime are skipped.
+  std::deque<u64> reissue;
+  // Connections waiting for boards, in the order they asked.
+  std::deque<Request> waiting;
+  // The average time, from going out, a board took to come back. An
+  // exponential moving average, so it follows the boards getting harder.
+  double turnaround;
+  double next_expiry_check;
+
+  u64 handed_out; // Copies, so reissues and duplicates count.
+  u64 returned;
+  u64 reissued;
+  u64 speculated;
+  u64 duplicates;
+
+  bool held_by(const Lease & lease, u32 connection) {
+    return std::find(lease.owners.begin(), lease.owners.end(), connection) !=
+           lease.owners.end();
+  }
+
+  // A queued lease that connection doesn't already have a copy of.
+  bool next_reissue(u32 connection, u64 & id) {
+    for(auto queued = reissue.begin(); queued != reissue.end(); ) {
+      auto lease = leases.find(*queued);
+      if(lease == leases.end()) {
+        queued = reissue.erase(queued);
+      } else if(held_by(lease->second, connection)) {
+        ++queued;
+      } else {
+        id = *queued;
+        reissue.erase(queued);
+        lease->second.queued = false;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // The longest-running lease that's out to one other connection only, and
+  // has been out for longer than boards have been taking.
+  bool next_straggler(u32 connection, u64 & id) {
+    double time = now();
+    double oldest = time;
+    for(const auto & [lease_id, lease] : leases) {
+      if(lease.queued || lease.owners.size() != 1 ||
+         lease.owners[0] == connection || lease.issued >= oldest ||
+         time - lease.issued <= lease.expected) {
+        continue;
+      }
+      oldest = lease.issued;
+      id = lease_id;
+    }
+    if(oldest == time) {
+      return false;
+    }
+    speculated++;
+    return true;
+  }
+
+  // The next lease to hand to connection, if there is one yet: one to
+  // reissue, then a new board, and once the boards have run out, a straggler.
+  bool next_unit(u32 connection, u64 & id) {
+    if(next_reissue(connection, id)) {
+      return true;
+    }
+    std::string unit;
+    LeafQueue::PopResult pop_result = leaves.pop(unit);
+    exhausted = pop_result == LeafQueue::exhausted;
+    if(pop_result == LeafQueue::popped) {
+      id = next_lease++;
+      leases[id] = Lease{unit, {}, 0, 0, false};
+      return true;
+    }
+    return exhausted && next_straggler(connection, id);
   }
 
-  void walk() {
-    _walk(2);
+  void issue(u32 connection, u64 id) {
+    Lease & lease = leases[id];
+    lease.owners.push_back(connection);
+    lease.issued = now();
+    lease.expected = turnaround;
+    outstanding[connection].push_back(Held{id, lease.issued});
+    handed_out++;
   }
 
-  void all() {
-    push(board_mid, board_mid);
-    for(u16 dy=0; dy<=2; dy++) {
-      for(u16 dx=0; dx<=2; dx++) {
-        if(dx || dy) {
-          push(board_mid + dx, board_mid + dy);
-          _all(2);
-          pop(board_mid + dx, board_mid + dy);
-        }
+  void queue_reissue(u64 id, Lease & lease) {
+    lease.queued = true;
+    reissue.push_back(id);
+  }
+
+  // Puts back the leases a connection has out that nobody else has a copy of.
+  void take_back(u32 connection) {
+    auto walking = outstanding.find(connection);
+    if(walking == outstanding.end()) {
+      return;
+    }
+    for(const Held & held : walking->second) {
+      auto lease = leases.find(held.lease);
+      if(lease == leases.end()) {
+        continue;
+      }
+      std::erase(lease->second.owners, connection);
+      if(lease->second.owners.empty() && !lease->second.queued) {
+        queue_reissue(held.lease, lease->second);
       }
     }
-    report_counts(true);
+    outstanding.erase(walking);
   }
 
-  //TODO: move to private:
-  void _expand(std::set<Square *> & expanded) {
-    ITERATE(visited, square) {
-      for(s16 dy=-2; dy<=2; dy++) {
-        for(s16 dx=-2; dx<=2; dx++) {
-          expanded.insert(&squares[square->y+dy][square->x+dx]);
-        }
+  // A connection that's stopped (a preempted node, say) can keep its socket
+  // open for a long time, so leases can't wait on connections closing.
+  void expire_leases() {
+    double time = now();
+    if(time < next_expiry_check) {
+      return;
+    }
+    next_expiry_check = time + expiry_check_every;
+    for(auto & [id, lease] : leases) {
+      double lease_time = std::max(min_lease, lease_factor * lease.expected);
+      if(!lease.queued && time - lease.issued > lease_time) {
+        queue_reissue(id, lease);
+        reissued++;
       }
     }
   }
 
-  //TODO: move to private:
-  void _all(u32 depth) {
-    if(/*depth > 4 or*/ not check_and_update_walked_set()) {
-      if(depth < max_depth) {
-        //The visited list won't be used for depth < max depth, so don't
-        //go through the overhead of clearing it.
-        refresh_visited_list();
-      }
-      walk();
-      checked_board_counts[depth]++;
-      if(depth < max_depth) {
-        report_counts();
-
-        std::set<Square *> expanded;
-        _expand(expanded);
-        for(Square * square : expanded) {
-          if(square->val == 0) {
-            push(square->x, square->y);
-            _all(depth + 1);
-            pop(square->x, square->y);
-          }
-        }
+  // Records results only if they're well formed and there are no more of
+  // them than the connection has boards out. Otherwise everything it has out
+  // is handed out again. Results for leases that already came back from
+  // another copy are dropped.
+  bool record(u32 connection, PayloadReader & reader) {
+    auto walking = outstanding.find(connection);
+    u64 out = walking == outstanding.end() ? 0 : walking->second.size();
+    u16 result_count = reader.get_u16();
+    std::vector<std::string> solutions(result_count);
+    std::vector<u16> stone_counts(result_count);
+    std::vector<u16> scores(result_count);
+    std::vector<u64> counts(result_count);
+    for(u32 i=0; i<result_count; i++) {
+      stone_counts[i] = reader.get_u16();
+      scores[i] = reader.get_u16();
+      counts[i] = reader.get_u64();
+      solutions[i] = reader.get_string();
+    }
+    if(!reader.finished() || result_count > out) {
+      return false;
+    }
+    // Every board handed out is a max_depth board, walked by itself, and each
+    // result has to be for a board like the one its lease went out with. All
+    // of them are checked before any are taken.
+    for(u32 i=0; i<result_count; i++) {
+      if(stone_counts[i] != max_depth || counts[i] != 1 ||
+         !is_board_string(solutions[i], max_depth)) {
+        return false;
+      }
+      auto lease = leases.find(walking->second[i].lease);
+      if(lease != leases.end() &&
+         std::count(lease->second.unit.begin(), lease->second.unit.end(),
+                    '|') != stone_counts[i]) {
+        return false;
+      }
+    }
+    double time = now();
+    for(u32 i=0; i<result_count; i++) {
+      Held held = walking->second.front();
+      walking->second.pop_front();
+      auto lease = leases.find(held.lease);
+      if(lease == leases.end()) {
+        duplicates++;
+        continue;
+      }
+      remote_count += counts[i];
+      if(scores[i] > remote_best ||
+         (scores[i] == remote_best && solutions[i] < remote_solution)) {
+        remote_best = scores[i];
+        remote_solution = solutions[i];
       }
+      double taken = time - held.issued;
+      turnaround = turnaround == 0 ? taken : 0.9 * turnaround + 0.1 * taken;
+      leases.erase(lease);
+      returned++;
     }
+    if(out > 0 && walking->second.empty()) {
+      outstanding.erase(walking);
+    }
+    return true;
   }
 
-  void push(u16 x, u16 y) {
-    Square * square = &(squares[y][x]);
-    one_point_squares_list.one_point_squares_insert(square);
-    one_point_count++;
-
-    square->cached_neighbor_sum = square->neighbor_sum;
-
-    square->neighbor_sums_erase();
-    square->neighbor_sum = 0;
-
-    _push(x, y, 1);
+  void handle(const Server::Message & message) {
+    if(message.closed) {
+      take_back(message.connection);
+      std::erase_if(waiting, [&](const Request & request) {
+        return request.connection == message.connection;
+      });
+      return;
+    }
+    PayloadReader reader(message.payload);
+    u16 wanted = reader.get_u16();
+    if(message.type != results_message ||
+       !record(message.connection, reader)) {
+      fprintf(stderr, "Dropping a malformed message from client %u\n",
+              message.connection);
+      take_back(message.connection);
+    }
+    if(wanted > 0) {
+      waiting.push_back(Request{message.connection, wanted});
+    }
   }
 
-  void pop(u16 x, u16 y) {
-    Square * square = &squares[y][x];
-    square->one_point_squares_erase();
-    one_point_count--;
+  // Sends whoever's waiting what there is for them, in order. Anyone left
+  // with nothing stays waiting.
+  void hand_out() {
+    for(auto request = waiting.begin(); request != waiting.end(); ) {
+      std::vector<u64> batch;
+      u64 id;
+      while(batch.size() < request->wanted &&
+            next_unit(request->connection, id)) {
+        batch.push_back(id);
+        issue(request->connection, id);
+      }
+      if(batch.empty()) {
+        ++request;
+        continue;
+      }
+      PayloadWriter writer;
+      writer.put_u16(batch.size());
+      for(u64 batched : batch) {
+        writer.put_string(leases[batched].unit);
+      }
+      server.send(request->connection, boards_message, writer.payload);
+      request = waiting.erase(request);
+    }
+  }
 
-    square->neighbor_sum = square->cached_neighbor_sum;
+public:
+  Orchestrator(u16 max_depth_requested, u16 port, bool orderly,
+               bool recursive, const char * walked_dir, u32 lease_seconds,
+               const char * dedup_addresses) :
+      server(port),
+      max_depth(max_depth_requested),
+      board(new Board(max_depth)),
+      dedup(NULL),
+      remote_count(0),
+      remote_best(0),
+      min_lease(lease_seconds),
+      exhausted(false),
+      next_lease(0),
+      turnaround(0),
+      next_expiry_check(0),
+      handed_out(0),
+      returned(0),
+      reissued(0),
+      speculated(0),
+      duplicates(0)
+  {
+    board->serve_leaves(&leaves);
+    board->set_orderly(orderly);
+    board->set_recursive(recursive);
+    if(walked_dir != NULL) {
+      board->use_walked_files(walked_dir);
+    }
+    if(dedup_addresses != NULL) {
+      dedup = new DedupShards(dedup_addresses, [this](const std::string & unit){
+        leaves.push(unit);
+      });
+      board->use_dedup_shards(dedup);
+    }
+  }
 
-    _pop(x, y);
+  ~Orchestrator() {
+    delete board;
+    delete dedup;
   }
 
-  void print(bool print_first_repr=true, bool print_all_reprs=false,
-             bool print_neighbor_sum_lists=false, bool force=true) {
-    if(!force) {
-      return;
-    }
+  void run() {
+    std::thread search([this]{
+      board->enumerate();
+      if(dedup != NULL) {
+        dedup->finish();
+      }
+      leaves.finish();
+    });
 
-    u16 min_x_visited, max_x_visited, min_y_visited, max_y_visited;
-    u16 min_x_active = u16_max, max_x_active = u16_min,
-        min_y_active = u16_max, max_y_active = u16_min;
+    std::vector<Server::Message> messages;
+    while(true) {
+      // The search doesn't wake poll() up when it queues a board, so don't
+      // sleep long while anyone's waiting for one.
+      server.poll(messages, waiting.empty() ? 100 : 1);
+      for(const Server::Message & message : messages) {
+        handle(message);
+      }
+      messages.clear();
 
-    get_visited_extents(
-        min_x_visited, min_y_visited, max_x_visited, max_y_visited);
+      expire_leases();
+      hand_out();
+      if(exhausted && leases.empty()) {
+        break;
+      }
 
-    for(u16 y=min_y_visited; y<=max_y_visited; y++) {
-      for(u16 x=min_x_visited; x<=max_x_visited; x++) {
-        if(squares[y][x].val) {
-          min_x_active = std::min(min_x_active, x);
-          min_y_active = std::min(min_y_active, y);
-          max_x_active = std::max(max_x_active, x);
-          max_y_active = std::max(max_y_active, y);
-        }
+      if(progress_timer()) {
+        printf("handed out: %lu, returned: %lu, leased: %lu, queued: %lu, "
+               "clients: %u\n", handed_out, returned, leases.size(),
+               leaves.size(), server.connection_count());
+        fflush(stdout);
       }
     }
-
-    printf("    y\\x|");
-    for(u16 x=min_x_active-1; x<=max_x_active+1; x++) {
-      printf("%7d|", x);
+    // Some may still be walking duplicates, so everyone gets told.
+    for(const auto & [connection, held] : outstanding) {
+      server.send(connection, done_message, "");
     }
-    printf("\n");
-    for(u16 y=min_y_active-1; y<=max_y_active+1; y++) {
-      printf("%7d", y);
-      for(u16 x=min_x_active-1; x<=max_x_active+1; x++) {
-        printf("|");
-        squares[y][x].print();
+    for(const Request & request : waiting) {
+      if(!outstanding.contains(request.connection)) {
+        server.send(request.connection, done_message, "");
       }
-      printf("|\n");
     }
-    if(print_first_repr or print_all_reprs) {
-      check_and_update_walked_set(true, true);
-      if(print_all_reprs) {
-        for(u32 i=0; i<8; i++) {
-          printf("%s\n", packed_repr_buffs[i]);
+    printf("leases: %lu reissued, %lu duplicated, %lu duplicate results "
+           "dropped\n", reissued, speculated, duplicates);
+
+    search.join();
+    if(remote_count > 0) {
+      board->record_result(max_depth, remote_best, remote_solution,
+                           remote_count);
+    }
+    if(dedup != NULL) {
+      dedup->report();
+    }
+    board->report_counts(true);
+  }
+};
+
+// The -c side of a distributed run: walks boards for an Orchestrator until it
+// says it's done.
+//
+// The socket is left to a thread of its own, so the walks never wait on the
+// network. Boards come in to a queue, batch at a time: whenever the queue is
+// down to batch boards, the I/O thread asks for batch more, so the next batch
+// is usually in long before the last one's walked. Results go back with that
+// request, or on their own if batch of them pile up first, or if the queue
+// has run dry (the server may be waiting on them to finish).
+class Worker {
+private:
+  const char * address;
+  u16 port;
+  u16 batch;
+  Board * board;
+  Client * client;
+
+  // Everything below is shared with the I/O thread, under the mutex.
+  std::mutex mutex;
+  std::condition_variable ready; // There are units, or we're done.
+  std::deque<std::string> units;
+  PayloadWriter results;
+  u16 result_count;
+  bool done;
+  bool starved; // The walks are waiting on an empty queue.
+  // Written to to have the I/O thread look at the queue again. It sleeps in
+  // poll(), on this and the socket both.
+  s32 wake_pipe[2];
+
+  void wake_io() {
+    char byte = 0;
+    write(wake_pipe[1], &byte, 1);
+  }
+
+  void io_loop() {
+    bool requested = false;
+    while(true) {
+      PayloadWriter message;
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        bool refill = !requested && units.size() <= batch;
+        bool flush = result_count > 0 && (result_count >= batch || starved);
+        if(refill || flush) {
+          message.put_u16(refill ? batch : 0);
+          message.put_u16(result_count);
+          message.payload += results.payload;
+          results.payload.clear();
+          result_count = 0;
+          requested |= refill;
         }
-      } else {
-        printf("%s\n", packed_repr_buffs[0]);
       }
-    }
-    if(print_neighbor_sum_lists) {
-      for(u32 i=0; i<max_neighbor_sums; i++) {
-        if(neighbor_sums_list[i].neighbor_sums_next != &neighbor_sums_ends[i]) {
-          printf("%d: ", i);
-          u32 count=0;
-          ITERATE_INDEX(neighbor_sums, i, iter) {
-            printf(" <%d,%d>", iter->x, iter->y);
-            count++;
-          }
-          printf(" (%d squares)\n", count);
+      if(!message.payload.empty()) {
+        client->send_frame(results_message, message.payload);
+      }
+
+      // Frames already read in come first: poll() would wait on the socket
+      // for them forever. The done frame can arrive with the last batch.
+      if(!client->has_frame()) {
+        struct pollfd fds[2] = {{client->socket_fd(), POLLIN, 0},
+                                {wake_pipe[0], POLLIN, 0}};
+        if(poll(fds, 2, -1) < 0) {
+          continue;
+        }
+        if(fds[1].revents) {
+          char bytes[64];
+          read(wake_pipe[0], bytes, sizeof(bytes));
         }
+        if(!fds[0].revents) {
+          continue;
+        }
+      }
+
+      u8 type;
+      std::string payload;
+      if(!client->receive_frame(type, payload)) {
+        fprintf(stderr, "Lost the connection to the server\n");
+        exit(1);
+      }
+      std::lock_guard<std::mutex> lock(mutex);
+      if(type == done_message) {
+        // Anything still queued was handed out again, and has come back.
+        units.clear();
+        done = true;
+        ready.notify_all();
+        return;
+      }
+      PayloadReader reader(payload);
+      u16 unit_count = reader.get_u16();
+      for(u32 i=0; i<unit_count; i++) {
+        units.push_back(reader.get_string());
+      }
+      if(type != boards_message || !reader.finished()) {
+        fprintf(stderr, "The server sent a malformed batch\n");
+        exit(1);
       }
+      requested = false;
+      ready.notify_all();
     }
   }
 
-  void print_string_reprs() {
-    check_and_update_walked_set(true, true);
-    for(u32 i=0; i<8; i++) {
-      printf("%d: %s\n", i, packed_repr_buffs[i]);
+public:
+  Worker(u16 max_depth, const char * address_requested, u16 port_requested,
+         u16 batch_requested, bool prune, u16 target_score, bool recursive) :
+      address(address_requested),
+      port(port_requested),
+      batch(batch_requested),
+      board(new Board(max_depth)),
+      client(NULL),
+      result_count(0),
+      done(false),
+      starved(false)
+  {
+    board->set_pruning(prune, target_score);
+    board->set_recursive(recursive);
+  }
+
+  ~Worker() {
+    delete board;
+  }
+
+  void run() {
+    Client connection(address, port);
+    client = &connection;
+    if(pipe(wake_pipe) < 0) {
+      perror("pipe failed");
+      exit(1);
     }
-    fflush(stdout);
+    std::thread io(&Worker::io_loop, this);
+
+    double start = now();
+    double starved_time = 0;
+    u64 walked = 0;
+    std::string unit;
+    while(true) {
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        if(units.empty() && !done) {
+          starved = true;
+          wake_io();
+          double wait_start = now();
+          ready.wait(lock, [this]{ return !units.empty() || done; });
+          starved_time += now() - wait_start;
+          starved = false;
+        }
+        if(units.empty()) {
+          break;
+        }
+        unit = units.front();
+        units.pop_front();
+        if(units.size() == batch) {
+          wake_io();
+        }
+      }
+
+      board->load(unit);
+      u16 score = board->walk(true);
+      walked++;
+
+      std::lock_guard<std::mutex> lock(mutex);
+      results.put_u16(board->stone_count());
+      results.put_u16(score);
+      results.put_u64(1);
+      results.put_string(board->canonical_repr());
+      result_count++;
+      if(result_count == batch) {
+        wake_io();
+      }
+    }
+    io.join();
+    close(wake_pipe[0]);
+    close(wake_pipe[1]);
+
+    double elapsed = now() - start;
+    printf("walked %lu boards in %.3fs, starved for %.3fs (%.1f%%)\n", walked,
+           elapsed, starved_time, 100 * starved_time / elapsed);
   }
 };
 
@@ -672,15 +3742,66 @@ class ArgParse {
 private:
   void usage(s32 exit_val) {
     fflush(stderr);
-    printf("usage: infchess max_depth -c -a=remote_addr -p=port_number|\n");
-    printf("       infchess max_depth -s -p=port_number\n");
-    printf("       infchess max_depth\n");
-    printf("       infchess max_depth -b=board_string\n\n");
+    printf("usage: infchess max_depth -c -a=remote_addr -p=port_number [prune]\n");
+    printf("                [--batch=BOARDS]\n");
+    printf("       infchess max_depth -s -p=port_number [-o] [--lease=SECONDS]\n");
+    printf("                [--dedup=HOST:PORT[,HOST:PORT...]]\n");
+    printf("       infchess max_depth [-j=thread_count] [-o [checkpoint]] [prune]\n");
+    printf("       infchess max_depth -b=board_string [prune] [--bench=REPS]\n");
+    printf("                [--bench-keys=REPS]\n\n");
+    printf("where prune is [--prune [--target=SCORE]]\n");
+    printf("and checkpoint is [--checkpoint=FILE] [--checkpoint-every=SECONDS]\n");
+    printf("                  [--resume=FILE]\n");
+    printf("       infchess max_depth --bench-walked=COUNT [--walked-dir=DIR]\n");
+    printf("       infchess max_depth --dedup-shard -p=port_number\n");
+    printf("       infchess max_depth --load-test=CLIENTS -p=port_number\n");
+    printf("                [--batch=BOARDS]\n\n");
+    printf("Any form that keeps walked boards also takes --walked-dir=DIR.\n\n");
+    printf("Any form also takes --recursive, --no-simd, and\n");
+    printf("--simd-neighbors.\n\n");
     printf("The first form creates a worker client and connects to the\n");
-    printf("server at the remote_addr and port_numer given\n\n");
+    printf("server at the remote_addr and port_numer given. It asks for\n");
+    printf("BOARDS boards at a time (16 by default), ahead of time, and\n");
+    printf("reports how long it spent waiting for them.\n\n");
     printf("The second form creates an orchestrator process to which\n");
-    printf("the clients will connect.\n\n");
-    printf("The third form creates a local-only process\n\n");
+    printf("the clients will connect. A board that doesn't come back from\n");
+    printf("its client within SECONDS seconds (30 by default), or four times\n");
+    printf("as long as boards have been taking if that's longer, goes out\n");
+    printf("again to another. Near the end of the run, idle clients also\n");
+    printf("get copies of the boards that are taking longest.\n\n");
+    printf("With --dedup, the second form keeps the boards at max_depth it's\n");
+    printf("already handed out in --dedup-shard processes at each HOST:PORT,\n");
+    printf("each holding its own range of them, rather than in memory. It\n");
+    printf("reports how many boards they turned away, and how long they took\n");
+    printf("to answer. Start a new set of shards for each run.\n\n");
+    printf("The third form creates a local-only process. With -j, the\n");
+    printf("search is spread over thread_count threads (0 means one per\n");
+    printf("core).\n\n");
+    printf("With -o, the first and third forms generate each board once, in\n");
+    printf("canonical order, instead of remembering every board walked.\n");
+    printf("That holds no per-board state, but generating the boards is much\n");
+    printf("slower: about 15m rather than 15s at depth 5, before any walks.\n\n");
+    printf("--checkpoint saves the progress of the third form to FILE every\n");
+    printf("SECONDS seconds (60 by default). --resume picks up from a saved\n");
+    printf("FILE, skipping the work already done, and keeps saving to it\n");
+    printf("unless --checkpoint says otherwise. Both need -o.\n\n");
+    printf("--walked-dir keeps the set of boards already walked in files in\n");
+    printf("DIR, paged in and out by the kernel, rather than in memory. With\n");
+    printf("--bench-walked, nothing is searched: COUNT keys go into each kind\n");
+    printf("of set, and the times are compared. DIR defaults to /tmp.\n\n");
+    printf("--load-test serves CLIENTS client processes of its own on the\n");
+    printf("loopback address at once, each trading a fixed number of boards\n");
+    printf("with it as a worker would, BOARDS at a time, and times them.\n\n");
+    printf("--prune stops walking a max_depth board as soon as it can't\n");
+    printf("reach the best score found so far, or SCORE if that's higher.\n");
+    printf("Without it, every board is walked in full. The scores of the\n");
+    printf("best boards are the same either way.\n\n");
+    printf("--recursive searches with the recursive engine rather than the\n");
+    printf("iterative one. They give the same results.\n\n");
+    printf("--no-simd uses the plain versions of the board key code even\n");
+    printf("if the CPU has AVX2. --simd-neighbors updates the neighbor\n");
+    printf("sums of a walk with AVX2 too; that's slower so far, so it's\n");
+    printf("off by default.\n\n");
     printf("The final form takes a packed board string of the following\n");
     printf("form, where all values are hex. yx values are 8 bits of y,\n");
     printf("then 8 bits of x:\n\n");
@@ -689,9 +3810,106 @@ private:
     printf("\t2: 3x3|0|202                    16 points\n");
     printf("\t3: 5x6|0|402|504                28 points\n");
     printf("\t4: 7x5|3|300|306|402            38 points\n");
-    printf("\t5: ax7|9|203|407|509|600        49 points\n");
+    printf("\t5: ax7|9|203|407|509|600        49 points\n\n");
+    printf("With --bench, the board is walked REPS times with each engine,\n");
+    printf("with and without AVX2, and the times are compared. With\n");
+    printf("--bench-keys, its keys are built REPS times with and without\n");
+    printf("AVX2 instead.\n");
     exit(exit_val);
   }
+
+  void parse_long_option(const char * arg) {
+    std::string option(arg);
+    std::string target_prefix = "--target=";
+    std::string bench_prefix = "--bench=";
+    std::string checkpoint_prefix = "--checkpoint=";
+    std::string every_prefix = "--checkpoint-every=";
+    std::string resume_prefix = "--resume=";
+    std::string walked_dir_prefix = "--walked-dir=";
+    std::string bench_walked_prefix = "--bench-walked=";
+    std::string bench_keys_prefix = "--bench-keys=";
+    std::string load_test_prefix = "--load-test=";
+    std::string batch_prefix = "--batch=";
+    std::string lease_prefix = "--lease=";
+    std::string dedup_prefix = "--dedup=";
+    if(option == "--prune") {
+      prune = true;
+    } else if(option == "--recursive") {
+      recursive = true;
+    } else if(option == "--no-simd") {
+      no_simd = true;
+    } else if(option == "--simd-neighbors") {
+      simd_neighbors = true;
+    } else if(option == "--dedup-shard") {
+      dedup_shard = true;
+    } else if(option.compare(0, dedup_prefix.size(), dedup_prefix) == 0) {
+      dedup_addresses = arg + dedup_prefix.size();
+    } else if(option.compare(0, checkpoint_prefix.size(),
+                             checkpoint_prefix) == 0) {
+      checkpoint_file = arg + checkpoint_prefix.size();
+    } else if(option.compare(0, every_prefix.size(), every_prefix) == 0) {
+      checkpoint_every = atoi(arg + every_prefix.size());
+      if(checkpoint_every == 0) {
+        fprintf(stderr, "--checkpoint-every syntax: "
+                        "--checkpoint-every=SECONDS\n");
+        usage(1);
+      }
+    } else if(option.compare(0, resume_prefix.size(), resume_prefix) == 0) {
+      resume_file = arg + resume_prefix.size();
+    } else if(option.compare(0, walked_dir_prefix.size(),
+                             walked_dir_prefix) == 0) {
+      walked_dir = arg + walked_dir_prefix.size();
+    } else if(option.compare(0, bench_walked_prefix.size(),
+                             bench_walked_prefix) == 0) {
+      bench_walked = strtoul(arg + bench_walked_prefix.size(), NULL, 10);
+      if(bench_walked == 0) {
+        fprintf(stderr, "--bench-walked syntax: --bench-walked=COUNT\n");
+        usage(1);
+      }
+    } else if(option.compare(0, batch_prefix.size(), batch_prefix) == 0) {
+      batch = atoi(arg + batch_prefix.size());
+      if(batch == 0 || batch > max_batch) {
+        fprintf(stderr, "--batch syntax: --batch=BOARDS, at most %u\n",
+                max_batch);
+        usage(1);
+      }
+    } else if(option.compare(0, lease_prefix.size(), lease_prefix) == 0) {
+      lease_seconds = atoi(arg + lease_prefix.size());
+      if(lease_seconds == 0) {
+        fprintf(stderr, "--lease syntax: --lease=SECONDS\n");
+        usage(1);
+      }
+    } else if(option.compare(0, load_test_prefix.size(),
+                             load_test_prefix) == 0) {
+      load_test_clients = atoi(arg + load_test_prefix.size());
+      if(load_test_clients == 0) {
+        fprintf(stderr, "--load-test syntax: --load-test=CLIENTS\n");
+        usage(1);
+      }
+    } else if(option.compare(0, bench_keys_prefix.size(),
+                             bench_keys_prefix) == 0) {
+      bench_keys = atoi(arg + bench_keys_prefix.size());
+      if(bench_keys == 0) {
+        fprintf(stderr, "--bench-keys syntax: --bench-keys=REPS\n");
+        usage(1);
+      }
+    } else if(option.compare(0, bench_prefix.size(), bench_prefix) == 0) {
+      bench_reps = atoi(arg + bench_prefix.size());
+      if(bench_reps == 0) {
+        fprintf(stderr, "--bench syntax: --bench=REPS\n");
+        usage(1);
+      }
+    } else if(option.compare(0, target_prefix.size(), target_prefix) == 0) {
+      target_score = atoi(arg + target_prefix.size());
+      if(target_score == 0) {
+        fprintf(stderr, "--target syntax: --target=SCORE\n");
+        usage(1);
+      }
+    } else {
+      fprintf(stderr, "Unknown option %s\n", arg);
+      usage(1);
+    }
+  }
 public:
   //TODO: Allow the processing of a single board from the command line, either
   //      via the packed_repr format, or a simple set of points.
@@ -700,6 +3918,25 @@ public:
       server(false),
       standalone(false),
       single_board(false),
+      threads(1),
+      orderly(false),
+      prune(false),
+      target_score(0),
+      recursive(false),
+      bench_reps(0),
+      checkpoint_file(NULL),
+      checkpoint_every(60),
+      resume_file(NULL),
+      walked_dir(NULL),
+      bench_walked(0),
+      bench_keys(0),
+      no_simd(false),
+      simd_neighbors(false),
+      load_test_clients(0),
+      batch(16),
+      lease_seconds(30),
+      dedup_shard(false),
+      dedup_addresses(NULL),
       port(0),
       max_depth(0),
       remote_address(NULL),
@@ -714,6 +3951,10 @@ public:
       fprintf(stderr, "Unable to parse max_depth\n");
       usage(1);
     }
+    if(max_depth > max_key_stones) {
+      fprintf(stderr, "max_depth can be at most %d\n", max_key_stones);
+      usage(1);
+    }
     for(s32 i=2; i<argc; i++) {
       if(argv[i][0] != '-') {
         usage(1);
@@ -762,6 +4003,22 @@ public:
           single_board = true;
           board_str=&argv[i][3];
           break;
+        case 'o':
+          orderly = true;
+          break;
+        case 'j':
+          if(argv[i][2] != '=') {
+            fprintf(stderr, "-j syntax: -j=THREAD_COUNT\n");
+            usage(1);
+          }
+          threads = atoi(&argv[i][3]);
+          if(threads == 0) {
+            threads = std::thread::hardware_concurrency();
+          }
+          break;
+        case '-':
+          parse_long_option(argv[i]);
+          break;
       }
     }
 
@@ -774,6 +4031,57 @@ public:
       usage(1);
     }
 
+    if(target_score > 0 && !prune) {
+      fprintf(stderr, "--target only means something with --prune\n");
+      usage(1);
+    }
+
+    if(resume_file != NULL && checkpoint_file == NULL) {
+      checkpoint_file = resume_file;
+    }
+    if(checkpoint_file != NULL && (!standalone || !orderly)) {
+      fprintf(stderr, "--checkpoint and --resume need -o, and don't work with "
+                      "-s, -c, or -b\n");
+      usage(1);
+    }
+
+    if(load_test_clients > 0 && (!standalone || port == 0)) {
+      fprintf(stderr, "--load-test needs -p, and doesn't work with -s, -c, "
+                      "or -b\n");
+      usage(1);
+    }
+
+    if(dedup_shard && (!standalone || port == 0)) {
+      fprintf(stderr, "--dedup-shard needs -p, and doesn't work with -s, -c, "
+                      "or -b\n");
+      usage(1);
+    }
+
+    if(dedup_addresses != NULL && (!server || orderly)) {
+      fprintf(stderr, "--dedup only works with -s, and not with -o\n");
+      usage(1);
+    }
+
+    if(bench_walked > 0 && !standalone) {
+      fprintf(stderr, "--bench-walked doesn't work with -s, -c, or -b\n");
+      usage(1);
+    }
+
+    if(bench_reps > 0 && !single_board) {
+      fprintf(stderr, "--bench only works with -b\n");
+      usage(1);
+    }
+
+    if(simd_neighbors && (no_simd || !simd_available())) {
+      fprintf(stderr, "--simd-neighbors needs AVX2, and not --no-simd\n");
+      usage(1);
+    }
+
+    if(bench_keys > 0 && (!single_board || bench_reps > 0)) {
+      fprintf(stderr, "--bench-keys only works with -b, and not with --bench\n");
+      usage(1);
+    }
+
     if(client && remote_address == NULL) {
       fprintf(stderr, "Remote IP is required when starting a client.\n");
       usage(1);
@@ -786,24 +4094,310 @@ public:
   bool single_board;
 
   u16 max_depth;
+  u32 threads;
+  bool orderly;
+  bool prune;
+  u16 target_score;
+  bool recursive;
+  u32 bench_reps;
+  const char * checkpoint_file;
+  u32 checkpoint_every;
+  const char * resume_file;
+  const char * walked_dir;
+  u64 bench_walked;
+  u32 bench_keys;
+  bool no_simd;
+  bool simd_neighbors;
+  u32 load_test_clients;
+  // A batch and its results have to fit in one frame.
+  static const u16 max_batch = 4096;
+  u16 batch;
+  u32 lease_seconds;
+  bool dedup_shard;
+  const char * dedup_addresses;
 
   u16 port;
   char * remote_address;
   char * board_str;
 };
 
+template <class Set>
+void bench_set(const char * name, Set & set, u64 count) {
+  // splitmix64, so the keys come out the same for every set. The top half is
+  // kept away from zero and all ones, which neither set can hold.
+  u64 state = 0;
+  auto next_key = [&state]() {
+    u64 z = (state += 0x9e3779b97f4a7c15UL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9UL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebUL;
+    z ^= z >> 31;
+    return ((u128)(z | 1) << 64) | (z >> 1);
+  };
+
+  double start = now();
+  for(u64 i=0; i<count; i++) {
+    set.insert(next_key());
+  }
+  double insert_time = now() - start;
+
+  // The same keys again, which are all there, then as many new ones, which
+  // aren't.
+  state = 0;
+  u64 found = 0;
+  start = now();
+  for(u64 i=0; i<2*count; i++) {
+    found += set.contains(next_key());
+  }
+  double lookup_time = now() - start;
+
+  printf("%-10s %lu keys: %.3fs to insert (%.1f M/s), "
+         "%.3fs for %lu lookups (%.1f M/s), %lu found\n",
+         name, set.size(), insert_time, count / insert_time / 1e6,
+         lookup_time, 2*count, 2*count / lookup_time / 1e6, found);
+}
+
+// Times the two kinds of set walked boards can be kept in.
+void bench_walked_sets(u64 count, const char * directory) {
+  {
+    KeySet set;
+    bench_set("in memory:", set, count);
+  }
+  {
+    MappedKeySet set(directory);
+    bench_set("mapped:", set, count);
+  }
+}
+
+// Forks client_count clients, which all connect to a Server on the loopback
+// address and go back and forth with it as workers would, batch boards at a
+// time, with made up boards and results. Every client moves the same number
+// of boards whatever the batch size, so the times compare.
+void load_test(u16 port, u32 client_count, u16 batch) {
+  const u32 boards_per_client = 4096;
+  const u32 rounds = (boards_per_client + batch - 1) / batch;
+  const std::string unit = "ax7|9|203|407|509|600";
+  Server server(port);
+  for(u32 i=0; i<client_count; i++) {
+    pid_t pid = fork();
+    if(pid < 0) {
+      perror("fork failed");
+      exit(1);
+    }
+    if(pid == 0) {
+      Client client("127.0.0.1", port);
+      PayloadWriter results;
+      u16 result_count = 0;
+      u8 type;
+      std::string payload;
+      for(u32 round=0; round<rounds; round++) {
+        PayloadWriter request;
+        request.put_u16(batch);
+        request.put_u16(result_count);
+        client.send_frame(results_message, request.payload + results.payload);
+        if(!client.receive_frame(type, payload)) {
+          _exit(1);
+        }
+        PayloadReader reader(payload);
+        result_count = reader.get_u16();
+        results.payload.clear();
+        for(u32 j=0; j<result_count; j++) {
+          results.put_u16(5);
+          results.put_u16(49);
+          results.put_u64(1);
+          results.put_string(reader.get_string());
+        }
+        if(!reader.finished()) {
+          _exit(1);
+        }
+      }
+      _exit(0);
+    }
+  }
+
+  std::vector<Server::Message> messages;
+  u64 round_trips = 0;
+  u64 boards = 0;
+  u32 most_connected = 0;
+  u32 exited = 0;
+  u32 failed = 0;
+  double start = now();
+  while(exited < client_count || server.connection_count() > 0) {
+    server.poll(messages, 10);
+    for(const Server::Message & message : messages) {
+      if(message.closed) {
+        continue;
+      }
+      PayloadReader reader(message.payload);
+      u16 wanted = reader.get_u16();
+      PayloadWriter writer;
+      writer.put_u16(wanted);
+      for(u32 i=0; i<wanted; i++) {
+        writer.put_string(unit);
+      }
+      server.send(message.connection, boards_message, writer.payload);
+      round_trips++;
+      boards += wanted;
+    }
+    messages.clear();
+    most_connected = std::max(most_connected, server.connection_count());
+
+    s32 status;
+    while(waitpid(-1, &status, WNOHANG) > 0) {
+      exited++;
+      if(!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        failed++;
+      }
+    }
+  }
+  double elapsed = now() - start;
+  printf("%u clients, batches of %u: %lu boards in %lu round trips, %.3fs, "
+         "%.0f boards/s\n", client_count, batch, boards, round_trips, elapsed,
+         boards / elapsed);
+  printf("at most %u connected at once, %u clients failed\n", most_connected,
+         failed);
+}
+
+// A --dedup-shard process: holds one range of an Orchestrator's walked boards
+// (see DedupShards), and answers its queries, until it disconnects. Each run
+// gets shards of its own, since the keys from one run would say the boards of
+// the next were already walked.
+//
+// The first connection to send a well-formed query is taken to be the
+// Orchestrator. Anything else that connects (a port scan, a stray client) is
+// ignored, and can come and go without ending the run.
+void serve_dedup_shard(u16 port, const char * walked_dir) {
+  Server server(port);
+  WalkedBoards walked;
+  if(walked_dir != NULL) {
+    walked.use_files(walked_dir);
+  }
+  u32 orchestrator = u32_max;
+  u64 queries = 0;
+  u64 duplicates = 0;
+  double busy = 0;
+  std::vector<Server::Message> messages;
+  while(true) {
+    server.poll(messages, -1);
+    for(const Server::Message & message : messages) {
+      if(message.closed) {
+        if(message.connection != orchestrator) {
+          continue;
+        }
+        printf("%lu keys held, %lu queries, %lu duplicates, %.3fs busy\n",
+               walked.boards.size() + (walked.mapped != NULL ?
+                                       walked.mapped->size() : 0),
+               queries, duplicates, busy);
+        walked.report();
+        return;
+      }
+      double start = now();
+      PayloadReader reader(message.payload);
+      u16 count = reader.get_u16();
+      std::vector<u128> keys(count);
+      for(u128 & key : keys) {
+        key = (u128)reader.get_u64() << 64;
+        key |= reader.get_u64();
+      }
+      bool well_formed = message.type == dedup_query_message &&
+                         reader.finished();
+      if(orchestrator == u32_max && well_formed) {
+        orchestrator = message.connection;
+      }
+      if(message.connection != orchestrator) {
+        fprintf(stderr, "Ignoring a message from client %u\n",
+                message.connection);
+        continue;
+      }
+      if(!well_formed) {
+        // Its keys can't be trusted to have gone in, so there's no carrying on.
+        fprintf(stderr, "Malformed query from the orchestrator\n");
+        exit(1);
+      }
+      std::vector<u64> masks((count + 63) / 64, 0);
+      for(u32 i=0; i<count; i++) {
+        if(walked.insert(keys[i])) {
+          masks[i / 64] |= (u64)1 << (i % 64);
+        } else {
+          duplicates++;
+        }
+      }
+      PayloadWriter answer;
+      answer.put_u16(count);
+      for(u64 mask : masks) {
+        answer.put_u64(mask);
+      }
+      server.send(message.connection, dedup_answer_message, answer.payload);
+      queries++;
+      busy += now() - start;
+    }
+    messages.clear();
+  }
+}
+
 int main(s32 argc, char * argv[]) {
   Board * board;
   ArgParse args(argc, argv);
-  if(args.standalone) {
+  if(args.no_simd) {
+    use_simd(false);
+  }
+  Board::simd_neighbors = args.simd_neighbors;
+  if(args.load_test_clients > 0) {
+    load_test(args.port, args.load_test_clients, args.batch);
+  } else if(args.dedup_shard) {
+    serve_dedup_shard(args.port, args.walked_dir);
+  } else if(args.bench_walked > 0) {
+    bench_walked_sets(args.bench_walked,
+                      args.walked_dir != NULL ? args.walked_dir : "/tmp");
+  } else if(args.standalone && (args.threads > 1 || args.checkpoint_file != NULL)) {
+    // Checkpoints go by BoardPool's units, so they use a pool even with one
+    // thread.
+    Checkpoint * checkpoint = NULL;
+    if(args.checkpoint_file != NULL) {
+      checkpoint = new Checkpoint(args.checkpoint_file, args.checkpoint_every,
+                                  args.max_depth);
+      if(args.resume_file != NULL) {
+        checkpoint->load(args.resume_file);
+      }
+    }
+    {
+      BoardPool pool(args.max_depth, args.threads, args.orderly, args.prune,
+                     args.target_score, args.recursive, checkpoint);
+      if(args.walked_dir != NULL) {
+        pool.use_walked_files(args.walked_dir);
+      }
+      pool.all();
+    }
+    delete checkpoint;
+  } else if(args.standalone) {
     board = new Board(args.max_depth);
+    board->set_orderly(args.orderly);
+    board->set_pruning(args.prune, args.target_score);
+    board->set_recursive(args.recursive);
+    if(args.walked_dir != NULL) {
+      board->use_walked_files(args.walked_dir);
+    }
     board->all();
   } else if (args.single_board) {
     board = new Board(args.max_depth, args.board_str);
-    board->walk();
+    board->set_pruning(args.prune, args.target_score);
+    board->set_recursive(args.recursive);
+    if(args.bench_reps > 0) {
+      board->bench_walk(args.bench_reps);
+    } else if(args.bench_keys > 0) {
+      board->bench_keys(args.bench_keys);
+    } else {
+      board->walk(true);
+      board->report_walk_nodes();
+    }
   } else if (args.server) {
+    Orchestrator orchestrator(args.max_depth, args.port, args.orderly,
+                              args.recursive, args.walked_dir,
+                              args.lease_seconds, args.dedup_addresses);
+    orchestrator.run();
   } else if (args.client) {
-    //Client(args.remote_address, args.port);
+    Worker worker(args.max_depth, args.remote_address, args.port, args.batch,
+                  args.prune, args.target_score, args.recursive);
+    worker.run();
   }
   exit(0);
 }
@@ -0,0 +1,90 @@
+#include "key_set.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+KeySet::KeySet(u64 initial_capacity) :
+    capacity(1),
+    count(0)
+{
+  while(capacity < initial_capacity) {
+    capacity <<= 1;
+  }
+  slots = new u128[capacity];
+  for(u64 i=0; i<capacity; i++) {
+    slots[i] = empty_key;
+  }
+}
+
+KeySet::~KeySet() {
+  delete [] slots;
+}
+
+// Keys are packed board coordinates, so the low bits are far from random.
+// Fold the halves together and run the result through the murmur3 finalizer.
+u64 KeySet::hash(u128 key) {
+  u64 h = (u64)key ^ ((u64)(key >> 64) * 0x9e3779b97f4a7c15UL);
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdUL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53UL;
+  h ^= h >> 33;
+  return h;
+}
+
+// Returns the slot holding key, or the empty slot where it would go.
+u64 KeySet::find_slot(u128 key) const {
+  u64 mask = capacity - 1;
+  u64 slot = hash(key) & mask;
+  while(slots[slot] != key && slots[slot] != empty_key) {
+    slot = (slot + 1) & mask;
+  }
+  return slot;
+}
+
+void KeySet::grow() {
+  u128 * old_slots = slots;
+  u64 old_capacity = capacity;
+
+  capacity <<= 1;
+  slots = new u128[capacity];
+  for(u64 i=0; i<capacity; i++) {
+    slots[i] = empty_key;
+  }
+  for(u64 i=0; i<old_capacity; i++) {
+    if(old_slots[i] != empty_key) {
+      slots[find_slot(old_slots[i])] = old_slots[i];
+    }
+  }
+  delete [] old_slots;
+}
+
+bool KeySet::contains(u128 key) const {
+  return slots[find_slot(key)] == key;
+}
+
+void KeySet::insert_new(u128 key) {
+  u64 mask = capacity - 1;
+  u64 slot = hash(key) & mask;
+  while(slots[slot] != empty_key) {
+    slot = (slot + 1) & mask;
+  }
+  slots[slot] = key;
+  count++;
+  if(count * 2 > capacity) {
+    grow();
+  }
+}
+
+bool KeySet::insert(u128 key) {
+  u64 slot = find_slot(key);
+  if(slots[slot] == key) {
+    return false;
+  }
+  slots[slot] = key;
+  count++;
+  if(count * 2 > capacity) {
+    grow();
+  }
+  return true;
+}
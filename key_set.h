@@ -0,0 +1,35 @@
+#ifndef _KEY_SET_H
+#define _KEY_SET_H
+
+#include "util.h"
+
+// A flat, open-addressed (linear probing) set of u128 keys. There's no erase;
+// the set only ever grows, doubling whenever it gets half full. The all-ones
+// key marks an empty slot and can't be inserted.
+class KeySet {
+private:
+  static constexpr u128 empty_key = ~(u128)0;
+
+  u128 * slots;
+  u64 capacity; // Always a power of two.
+  u64 count;
+
+  u64 find_slot(u128 key) const;
+  void grow();
+
+public:
+  static u64 hash(u128 key);
+
+  KeySet(u64 initial_capacity=1<<16);
+  ~KeySet();
+
+  bool contains(u128 key) const;
+  // Returns false if the key was already there.
+  bool insert(u128 key);
+  // For a key known not to be there (see BloomFilter): it only has to find
+  // an empty slot, without comparing against the keys on the way.
+  void insert_new(u128 key);
+  u64 size() const { return count; }
+};
+
+#endif // _KEY_SET_H
@@ -0,0 +1,30 @@
+#include <stddef.h>
+
+#include <atomic>
+
+#include "malloc_count.h"
+
+extern "C" void * __libc_malloc(size_t size);
+extern "C" void * __libc_calloc(size_t count, size_t size);
+extern "C" void * __libc_realloc(void * pointer, size_t size);
+
+static std::atomic<u64> mallocs(0);
+
+extern "C" void * malloc(size_t size) {
+  mallocs.fetch_add(1, std::memory_order_relaxed);
+  return __libc_malloc(size);
+}
+
+extern "C" void * calloc(size_t count, size_t size) {
+  mallocs.fetch_add(1, std::memory_order_relaxed);
+  return __libc_calloc(count, size);
+}
+
+extern "C" void * realloc(void * pointer, size_t size) {
+  mallocs.fetch_add(1, std::memory_order_relaxed);
+  return __libc_realloc(pointer, size);
+}
+
+u64 malloc_count() {
+  return mallocs.load(std::memory_order_relaxed);
+}
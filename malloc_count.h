@@ -0,0 +1,12 @@
+#ifndef _MALLOC_COUNT_H
+#define _MALLOC_COUNT_H
+
+#include "util.h"
+
+// Linking malloc_count.o replaces malloc(), calloc() and realloc() with
+// versions that count their calls before handing off to glibc. It's only
+// linked into the malloc-counting build (make infinite_chessboard2_mallocs),
+// which also defines COUNT_MALLOCS.
+u64 malloc_count();
+
+#endif // _MALLOC_COUNT_H
@@ -0,0 +1,127 @@
+#include "mapped_key_set.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "key_set.h"
+
+MappedKeySet::MappedKeySet(const std::string & directory_requested,
+                           u64 initial_capacity) :
+    directory(directory_requested),
+    count(0)
+{
+  u64 capacity = 1;
+  while(capacity * shard_count < initial_capacity) {
+    capacity <<= 1;
+  }
+  for(u32 i=0; i<shard_count; i++) {
+    shards[i].slots = map_slots(i, capacity);
+    shards[i].capacity = capacity;
+    shards[i].count = 0;
+  }
+}
+
+MappedKeySet::~MappedKeySet() {
+  for(u32 i=0; i<shard_count; i++) {
+    unmap_slots(shards[i].slots, shards[i].capacity);
+  }
+}
+
+// A new, zeroed, already-unlinked file of capacity slots, mapped in. The
+// mapping keeps the file alive, so the descriptor can go straight away.
+u128 * MappedKeySet::map_slots(u32 shard_index, u64 capacity) {
+  std::string filename = directory + "/walked-" + std::to_string(getpid()) +
+                         "-" + std::to_string(shard_index);
+  s32 fd = open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+  if(fd < 0) {
+    fprintf(stderr, "Unable to create %s\n", filename.c_str());
+    exit(1);
+  }
+  unlink(filename.c_str());
+  u64 bytes = capacity * sizeof(u128);
+  if(ftruncate(fd, bytes) != 0) {
+    fprintf(stderr, "Unable to size %s to %lu bytes\n", filename.c_str(), bytes);
+    exit(1);
+  }
+  void * slots = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if(slots == MAP_FAILED) {
+    fprintf(stderr, "Unable to map %s\n", filename.c_str());
+    exit(1);
+  }
+  close(fd);
+  return (u128 *)slots;
+}
+
+void MappedKeySet::unmap_slots(u128 * slots, u64 capacity) {
+  munmap(slots, capacity * sizeof(u128));
+}
+
+// Returns the slot holding key, or the empty slot where it would go. The top
+// bits of the hash picked the shard, so the slot comes from the bottom ones.
+u64 MappedKeySet::find_slot(const Shard & shard, u128 key, u64 hash) const {
+  u64 mask = shard.capacity - 1;
+  u64 slot = hash & mask;
+  while(shard.slots[slot] != key && shard.slots[slot] != 0) {
+    slot = (slot + 1) & mask;
+  }
+  return slot;
+}
+
+void MappedKeySet::grow(u32 shard_index) {
+  Shard & shard = shards[shard_index];
+  u128 * old_slots = shard.slots;
+  u64 old_capacity = shard.capacity;
+
+  shard.capacity <<= 1;
+  shard.slots = map_slots(shard_index, shard.capacity);
+  for(u64 i=0; i<old_capacity; i++) {
+    if(old_slots[i] != 0) {
+      u128 key = old_slots[i];
+      shard.slots[find_slot(shard, key, KeySet::hash(key))] = key;
+    }
+  }
+  unmap_slots(old_slots, old_capacity);
+}
+
+bool MappedKeySet::contains(u128 key) const {
+  u64 hash = KeySet::hash(key);
+  const Shard & shard = shards[hash >> (64 - shard_bits)];
+  return shard.slots[find_slot(shard, key, hash)] == key;
+}
+
+void MappedKeySet::insert_new(u128 key) {
+  u64 hash = KeySet::hash(key);
+  u32 shard_index = hash >> (64 - shard_bits);
+  Shard & shard = shards[shard_index];
+  u64 mask = shard.capacity - 1;
+  u64 slot = hash & mask;
+  while(shard.slots[slot] != 0) {
+    slot = (slot + 1) & mask;
+  }
+  shard.slots[slot] = key;
+  shard.count++;
+  count++;
+  if(shard.count * 2 > shard.capacity) {
+    grow(shard_index);
+  }
+}
+
+bool MappedKeySet::insert(u128 key) {
+  u64 hash = KeySet::hash(key);
+  u32 shard_index = hash >> (64 - shard_bits);
+  Shard & shard = shards[shard_index];
+  u64 slot = find_slot(shard, key, hash);
+  if(shard.slots[slot] == key) {
+    return false;
+  }
+  shard.slots[slot] = key;
+  shard.count++;
+  count++;
+  if(shard.count * 2 > shard.capacity) {
+    grow(shard_index);
+  }
+  return true;
+}
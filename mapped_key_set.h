@@ -0,0 +1,54 @@
+#ifndef _MAPPED_KEY_SET_H
+#define _MAPPED_KEY_SET_H
+
+#include <string>
+
+#include "util.h"
+
+// A KeySet that keeps its slots in memory-mapped files instead of on the heap,
+// so a set bigger than RAM gets paged to disk by the kernel rather than
+// running the machine out of memory.
+//
+// The keys are spread over shards by the top bits of their hash, and each
+// shard is its own open-addressed table in its own file, doubling on its own.
+// That way a grow only has to rehash (and have resident) one shard's worth of
+// slots at a time. The files are unlinked as soon as they're created, so
+// nothing is left behind however the process ends.
+//
+// A freshly extended file reads as zeros, so the zero key marks an empty slot
+// here and can't be inserted. Board keys are never zero.
+class MappedKeySet {
+private:
+  static const u32 shard_bits = 6;
+  static const u32 shard_count = 1 << shard_bits;
+
+  class Shard {
+  public:
+    u128 * slots;
+    u64 capacity; // Always a power of two.
+    u64 count;
+  };
+
+  std::string directory;
+  Shard shards[shard_count];
+  u64 count;
+
+  u128 * map_slots(u32 shard_index, u64 capacity);
+  void unmap_slots(u128 * slots, u64 capacity);
+  u64 find_slot(const Shard & shard, u128 key, u64 hash) const;
+  void grow(u32 shard_index);
+
+public:
+  // The files go in directory. initial_capacity is split across the shards.
+  MappedKeySet(const std::string & directory, u64 initial_capacity=1<<16);
+  ~MappedKeySet();
+
+  bool contains(u128 key) const;
+  // Returns false if the key was already there.
+  bool insert(u128 key);
+  // Same as KeySet::insert_new().
+  void insert_new(u128 key);
+  u64 size() const { return count; }
+};
+
+#endif // _MAPPED_KEY_SET_H
@@ -1,9 +1,16 @@
 #include "net_comms.h"
 
 #include <arpa/inet.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <netinet/in.h>
 #include <netinet/ip.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
 #include <sys/socket.h>
 //#include <sys/types.h>
 #include <unistd.h>
@@ -61,10 +68,43 @@ u32 SocketBase::socket_write(const char * message, u32 len) {
   return write(m_socket_fd, message, len);
 }
 
-u32 SocketBase::socket_read(char * message, u32 len) {
+s32 SocketBase::socket_read(char * message, u32 len) {
   return read(m_socket_fd, message, len);
 }
 
+// Tells the other end we're done sending, so it can read to EOF.
+void SocketBase::socket_shutdown_write() {
+  shutdown(m_socket_fd, SHUT_WR);
+}
+
+void SocketBase::append_frame(std::string & buffer, u8 type,
+                              const std::string & payload) {
+  u32 length = htonl(payload.size());
+  buffer.append((const char *)&length, sizeof(length));
+  buffer += (char)type;
+  buffer += payload;
+}
+
+s32 SocketBase::take_frame(const std::string & buffer, size_t & start,
+                           u8 & type, std::string & payload) {
+  if(buffer.size() - start < frame_header_size) {
+    return 0;
+  }
+  u32 length;
+  memcpy(&length, buffer.data() + start, sizeof(length));
+  length = ntohl(length);
+  if(length > max_frame_payload) {
+    return -1;
+  }
+  if(buffer.size() - start < frame_header_size + length) {
+    return 0;
+  }
+  type = buffer[start + sizeof(length)];
+  payload.assign(buffer, start + frame_header_size, length);
+  start += frame_header_size + length;
+  return 1;
+}
+
 void SocketBase::validate_socket() {
   if(fcntl(m_socket_fd, F_GETFD) < 0) {
     _error("fcntl is telling us the socket descriptor is invalid.", 1);
@@ -82,6 +122,13 @@ Server::Server(u16 port) {
 
   validate_socket();
 
+  // A client that dies mid-transaction shouldn't take the server with it.
+  signal(SIGPIPE, SIG_IGN);
+
+  // Let a restarted server rebind while old connections sit in TIME_WAIT.
+  s32 reuse = 1;
+  setsockopt(m_socket_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
   memset(&recv_addr, 0, sizeof(recv_addr));
 
   recv_addr.sin_family = AF_INET;
@@ -93,30 +140,196 @@ Server::Server(u16 port) {
   }
   validate_socket();
 
-  if(listen(m_socket_fd, 10) < 0) {
+  // Hundreds of workers may well all connect at once when the server starts.
+  if(listen(m_socket_fd, SOMAXCONN) < 0) {
     _error("listen failed", 1);
   }
   validate_socket();
+
+  fcntl(m_socket_fd, F_SETFL, fcntl(m_socket_fd, F_GETFL) | O_NONBLOCK);
+  m_epoll_fd = epoll_create1(0);
+  if(m_epoll_fd < 0) {
+    _error("epoll_create1 failed", 1);
+  }
+  m_next_connection = 0;
+
+  // The listening socket is the one thing watched without a connection
+  // number; it goes by u32_max instead.
+  struct epoll_event event;
+  event.events = EPOLLIN;
+  event.data.u32 = u32_max;
+  if(epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, m_socket_fd, &event) < 0) {
+    _error("epoll_ctl failed on the listening socket", 1);
+  }
 }
 
-bool Server::transact(const std::string & work_unit, std::string & result) {
-  const u32 max_bytes = 1000;
+Server::~Server() {
+  for(auto & entry : m_connections) {
+    close(entry.second.fd);
+  }
+  close(m_epoll_fd);
+}
+
+void Server::accept_all() {
+  while(true) {
+    s32 client_fd = accept4(m_socket_fd, NULL, NULL, SOCK_NONBLOCK);
+    if(client_fd < 0) {
+      if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+        _error("error accepting a connection", 0);
+      }
+      return;
+    }
+    // Messages are small and each one is waited on, so don't hold them back
+    // to fill a packet.
+    s32 no_delay = 1;
+    setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, &no_delay,
+               sizeof(no_delay));
+
+    u32 id = m_next_connection++;
+    Connection & connection = m_connections[id];
+    connection.fd = client_fd;
+    connection.want_write = false;
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.u32 = id;
+    if(epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, client_fd, &event) < 0) {
+      _error("epoll_ctl failed on a new connection", 0);
+      close(client_fd);
+      m_connections.erase(id);
+    }
+  }
+}
+
+// Reads everything there is, and splits off whole frames.
+void Server::read_from(u32 id, std::vector<Message> & messages) {
+  const u32 max_bytes = 4096;
   char buf[max_bytes];
+  Connection & connection = m_connections[id];
+  bool closed = false;
+  while(true) {
+    s32 bytes_read = read(connection.fd, buf, max_bytes);
+    if(bytes_read > 0) {
+      connection.in.append(buf, bytes_read);
+      continue;
+    }
+    if(bytes_read < 0 && errno == EINTR) {
+      continue;
+    }
+    if(bytes_read < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      break;
+    }
+    // EOF, or an error that means the same thing here.
+    if(bytes_read < 0) {
+      _error("error reading from a connection", 0);
+    }
+    closed = true;
+    break;
+  }
 
-  s32 client_fd = accept(m_socket_fd, NULL, NULL);
-  if(client_fd < 0) {
-    _error("error accepting transact connection", 0);
-    return false;
+  size_t start = 0;
+  Message message{id, false, 0, ""};
+  s32 took;
+  while((took = take_frame(connection.in, start, message.type,
+                           message.payload)) == 1) {
+    messages.push_back(message);
   }
+  connection.in.erase(0, start);
+  if(took < 0) {
+    fprintf(stderr, "Closing connection %u: it sent something that isn't a "
+                    "frame\n", id);
+    closed = true;
+  }
+  // Whole messages that came in before the end still count.
+  if(closed) {
+    close_connection(id, &messages);
+  }
+}
 
-  u32 bytes_read = read(client_fd, buf, max_bytes);
-  buf[bytes_read] = '\0';
-  result = std::string(buf);
-  write(client_fd, work_unit.c_str(), work_unit.size());
-  close(client_fd);
+// Sends as much of out as the socket takes. Returns false if the connection
+// turned out to be gone (and has been closed).
+bool Server::write_to(u32 id) {
+  Connection & connection = m_connections[id];
+  size_t sent = 0;
+  while(sent < connection.out.size()) {
+    s32 bytes_written = write(connection.fd, connection.out.data() + sent,
+                              connection.out.size() - sent);
+    if(bytes_written > 0) {
+      sent += bytes_written;
+      continue;
+    }
+    if(bytes_written < 0 && errno == EINTR) {
+      continue;
+    }
+    if(bytes_written < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      break;
+    }
+    // The next poll() reports it closed: epoll still has it as readable.
+    return false;
+  }
+  connection.out.erase(0, sent);
+  watch_writes(id, !connection.out.empty());
   return true;
 }
 
+void Server::watch_writes(u32 id, bool want_write) {
+  Connection & connection = m_connections[id];
+  if(connection.want_write == want_write) {
+    return;
+  }
+  connection.want_write = want_write;
+  struct epoll_event event;
+  event.events = EPOLLIN | (want_write ? (u32)EPOLLOUT : 0u);
+  event.data.u32 = id;
+  epoll_ctl(m_epoll_fd, EPOLL_CTL_MOD, connection.fd, &event);
+}
+
+// Reports the close in messages, if given.
+void Server::close_connection(u32 id, std::vector<Message> * messages) {
+  // Closing the fd takes it out of the epoll set too.
+  close(m_connections[id].fd);
+  m_connections.erase(id);
+  if(messages != NULL) {
+    messages->push_back(Message{id, true, 0, ""});
+  }
+}
+
+void Server::poll(std::vector<Message> & messages, s32 timeout_ms) {
+  const u32 max_events = 256;
+  struct epoll_event events[max_events];
+  s32 event_count = epoll_wait(m_epoll_fd, events, max_events, timeout_ms);
+  if(event_count < 0) {
+    if(errno != EINTR) {
+      _error("epoll_wait failed", 0);
+    }
+    return;
+  }
+  for(s32 i=0; i<event_count; i++) {
+    u32 id = events[i].data.u32;
+    if(id == u32_max) {
+      accept_all();
+      continue;
+    }
+    // An earlier event this time round may have closed it.
+    if(m_connections.find(id) == m_connections.end()) {
+      continue;
+    }
+    if(events[i].events & EPOLLOUT) {
+      write_to(id);
+    }
+    if(events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+      read_from(id, messages);
+    }
+  }
+}
+
+void Server::send(u32 connection, u8 type, const std::string & payload) {
+  auto found = m_connections.find(connection);
+  if(found == m_connections.end()) {
+    return;
+  }
+  append_frame(found->second.out, type, payload);
+  write_to(connection);
+}
 
 Client::Client(const char * address, u16 port) {
   struct sockaddr_in server_addr;
@@ -144,4 +357,110 @@ Client::Client(const char * address, u16 port) {
   if(connect(m_socket_fd, (struct sockaddr*)&server_addr, sizeof(server_addr)) == -1) {
     _error("connect failed.", 1);
   }
+
+  // Same as the server's end: every message is waited on.
+  s32 no_delay = 1;
+  setsockopt(m_socket_fd, IPPROTO_TCP, TCP_NODELAY, &no_delay,
+             sizeof(no_delay));
+}
+
+void Client::send_frame(u8 type, const std::string & payload) {
+  std::string frame;
+  append_frame(frame, type, payload);
+  size_t sent = 0;
+  while(sent < frame.size()) {
+    s32 bytes_written = write(m_socket_fd, frame.data() + sent,
+                              frame.size() - sent);
+    if(bytes_written < 0 && errno == EINTR) {
+      continue;
+    }
+    if(bytes_written <= 0) {
+      _error("error sending a frame", 1);
+    }
+    sent += bytes_written;
+  }
+}
+
+bool Client::has_frame() {
+  size_t start = 0;
+  u8 type;
+  std::string payload;
+  // Something that isn't a frame counts too; receive_frame() says so at once.
+  return take_frame(m_in, start, type, payload) != 0;
+}
+
+bool Client::receive_frame(u8 & type, std::string & payload) {
+  const u32 max_bytes = 4096;
+  char buf[max_bytes];
+  size_t start = 0;
+  s32 took;
+  while((took = take_frame(m_in, start, type, payload)) == 0) {
+    s32 bytes_read = read(m_socket_fd, buf, max_bytes);
+    if(bytes_read < 0 && errno == EINTR) {
+      continue;
+    }
+    if(bytes_read <= 0) {
+      return false;
+    }
+    m_in.append(buf, bytes_read);
+  }
+  if(took < 0) {
+    fprintf(stderr, "The server sent something that isn't a frame\n");
+    return false;
+  }
+  m_in.erase(0, start);
+  return true;
+}
+
+void PayloadWriter::put_u16(u16 value) {
+  value = htons(value);
+  payload.append((const char *)&value, sizeof(value));
+}
+
+void PayloadWriter::put_u64(u64 value) {
+  put_u16(value >> 48);
+  put_u16(value >> 32);
+  put_u16(value >> 16);
+  put_u16(value);
+}
+
+void PayloadWriter::put_string(const std::string & value) {
+  put_u16(value.size());
+  payload += value;
+}
+
+bool PayloadReader::has(size_t bytes) {
+  if(failed || payload.size() - at < bytes) {
+    failed = true;
+    return false;
+  }
+  return true;
+}
+
+u16 PayloadReader::get_u16() {
+  if(!has(sizeof(u16))) {
+    return 0;
+  }
+  u16 value;
+  memcpy(&value, payload.data() + at, sizeof(value));
+  at += sizeof(value);
+  return ntohs(value);
+}
+
+u64 PayloadReader::get_u64() {
+  u64 value = 0;
+  for(u32 i=0; i<4; i++) {
+    value = (value << 16) | get_u16();
+  }
+  return value;
+}
+
+std::string PayloadReader::get_string() {
+  u16 length = get_u16();
+  if(!has(length)) {
+    return "";
+  }
+  std::string value = payload.substr(at, length);
+  at += length;
+  return value;
 }
@@ -1,13 +1,32 @@
 #include "util.h"
 
 #include <string>
+#include <unordered_map>
+#include <vector>
 
+// Every message is a frame: a 5 byte header, with the length of the payload
+// (a u32) and the type of message (a u8), then the payload itself. What the
+// types mean, and what goes in the payload, is up to the two ends. The
+// header's length is in network byte order, as is everything put in a
+// payload with PayloadWriter.
 class SocketBase {
 protected:
   s32 m_socket_fd;
 
   void _error(const char * message, s32 exit_val);
 
+  static const u32 frame_header_size = 5;
+  // Anything longer is garbage rather than a real message.
+  static const u32 max_frame_payload = 1 << 26;
+
+  static void append_frame(std::string & buffer, u8 type,
+                           const std::string & payload);
+  // Takes the first frame off the front of buffer, starting at start, and
+  // moves start past it. Returns 1 if it did, 0 if the frame isn't all in yet,
+  // and -1 if what's there can't be a frame.
+  static s32 take_frame(const std::string & buffer, size_t & start, u8 & type,
+                        std::string & payload);
+
 public:
   SocketBase();
   ~SocketBase();
@@ -15,21 +34,115 @@ public:
   void validate_socket();
 
   u32 socket_write(const char * message, u32 len);
-  u32 socket_read(char * message, u32 len);
+  s32 socket_read(char * message, u32 len);
+  void socket_shutdown_write();
 };
 
+// Serves any number of clients at once from one thread. Connections stay open
+// for as many messages as the client likes, and none of the sockets ever
+// block: epoll says which ones are ready, and each connection keeps whatever
+// it's read of a message so far, and whatever it still has to send, in
+// buffers of its own.
 class Server: public SocketBase {
+public:
+  class Message {
+  public:
+    u32 connection;
+    // Set (with no payload) when the client has gone, or has sent something
+    // that isn't a frame. Nothing more comes from that connection, and
+    // anything sent to it is dropped.
+    bool closed;
+    u8 type;
+    std::string payload;
+  };
+
 private:
+  class Connection {
+  public:
+    s32 fd;
+    std::string in; // Received, but not yet a whole message.
+    std::string out; // Still to be sent.
+    bool want_write; // Whether epoll is watching for room to send out.
+  };
+
+  s32 m_epoll_fd;
+  // Numbered rather than keyed by fd, so a closed connection's number never
+  // refers to a new client that happened to get its fd.
+  u32 m_next_connection;
+  std::unordered_map<u32, Connection> m_connections;
+
+  void accept_all();
+  void read_from(u32 id, std::vector<Message> & messages);
+  bool write_to(u32 id);
+  void watch_writes(u32 id, bool want_write);
+  void close_connection(u32 id, std::vector<Message> * messages);
 
 public:
   Server(u16 port);
-  bool transact(const std::string & work_unit, std::string & result);
+  ~Server();
+
+  // Waits up to timeout_ms (or forever, if it's negative) for something to
+  // happen, then adds every whole message that's come in to messages, in the
+  // order they came in on each connection.
+  void poll(std::vector<Message> & messages, s32 timeout_ms);
+  void send(u32 connection, u8 type, const std::string & payload);
+  u32 connection_count() { return m_connections.size(); }
 };
 
+// One persistent connection to a Server.
 class Client: public SocketBase {
 private:
+  std::string m_in; // Read past the end of the last message.
 
 public:
   Client(const char * address, u16 port);
 
+  // For poll()ing on, alongside other things.
+  s32 socket_fd() { return m_socket_fd; }
+
+  void send_frame(u8 type, const std::string & payload);
+  // Whether receive_frame() can return without reading: a read can bring in
+  // more than one frame, and poll() on the socket won't say the rest are there.
+  bool has_frame();
+  // Blocks until a whole frame is in. Returns false if the server closed the
+  // connection first.
+  bool receive_frame(u8 & type, std::string & payload);
+};
+
+// Builds up a payload.
+class PayloadWriter {
+public:
+  std::string payload;
+
+  void put_u16(u16 value);
+  void put_u64(u64 value);
+  // A u16 length, then the bytes.
+  void put_string(const std::string & value);
+};
+
+// Takes a payload apart again, in the same order. Reading past the end gives
+// zeros and empty strings and sets failed, so a reader only has to check once
+// at the end.
+class PayloadReader {
+private:
+  const std::string & payload;
+  size_t at;
+
+  bool has(size_t bytes);
+
+public:
+  bool failed;
+
+  PayloadReader(const std::string & payload_to_read) :
+      payload(payload_to_read),
+      at(0),
+      failed(false)
+  {
+  }
+
+  u16 get_u16();
+  u64 get_u64();
+  std::string get_string();
+  // Whether everything has been read, and nothing past it.
+  bool finished() { return !failed && at == payload.size(); }
 };